@@ -29,8 +29,51 @@
 
 #include <functional>
 #include <cstring>
+#include <cstddef>
 #include <stdexcept>
 #include <cstdint>
+#include <bit>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <optional>
+#include <exception>
+#include <utility>
+#include <string>
+#include <fstream>
+#include <array>
+#include <type_traits>
+
+#if defined(ARRAYMAP_HUGE_PAGES) && defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define ARRAYMAP_MMAP
+#endif
+
+#if !defined(ARRAYMAP_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) )
+#include <immintrin.h>
+#define ARRAYMAP_SIMD_X86
+#elif !defined(ARRAYMAP_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ARRAYMAP_SIMD_NEON
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ARRAYMAP_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define ARRAYMAP_PREFETCH(address)
+#endif
 
 
 /*
@@ -146,329 +189,848 @@ namespace arraymap{
                 };
         };
 
+    /*
+     * An ordering may also project the key onto another trivially copyable type, by declaring it as radix_type and
+     * mapping keys there with apply() and back with restore(). The tree is then built over the bytes of the radix type,
+     * which decide both the depth of the tree and the order of the keys, and the key type itself only has to be
+     * copyable. Without a radix_type the key is its own.
+     */
+    template<class Key, class Ordering, class = void>
+        struct ordering_radix{
+            typedef Key type;
+        };
+    template<class Key, class Ordering>
+        struct ordering_radix<Key, Ordering, std::void_t<typename Ordering::radix_type>>{
+            typedef typename Ordering::radix_type type;
+        };
+
+    /*
+     * Orders a struct by the listed members, the first one most significant, each as ordering_default orders it. The
+     * members are packed next to each other without the struct's padding, so
+     *      struct tenant_key{ std::uint32_t tenant; std::uint16_t shard; };
+     *      arraymap::ordering_members<tenant_key, &tenant_key::tenant, &tenant_key::shard>
+     * sorts by tenant, then shard, on a tree 12 tetrades deep instead of 16. restore() fills the members into a value
+     * initialized struct.
+     */
+    template<class T, auto... Members>
+        class ordering_members{
+            template<auto Member>
+                using member_type = std::remove_cvref_t<decltype(std::declval<const T&>().*Member)>;
+
+            public:
+                static_assert(sizeof...(Members) > 0, "ordering_members needs at least one member!");
+                static_assert((std::is_trivially_copyable<member_type<Members>>::value && ...), "ordering_members requires trivially copyable members!");
+
+                typedef std::array<unsigned char, (sizeof(member_type<Members>) + ...)> radix_type;
+
+                static radix_type apply(const T &value)
+                {
+                    radix_type radix;
+                    std::size_t offset = radix.size();
+                    ( put<Members>(radix, offset, value), ... );
+                    return radix;
+                }
+                static T restore(const radix_type &radix)
+                {
+                    T value{};
+                    std::size_t offset = radix.size();
+                    ( get<Members>(radix, offset, value), ... );
+                    return value;
+                }
+
+            private:
+                template<auto Member>
+                    static void put(radix_type &radix, std::size_t &offset, const T &value)
+                    {
+                        member_type<Member> field = ordering_default<member_type<Member>>::apply(value.*Member);
+                        offset -= sizeof(field);
+                        std::memcpy(radix.data() + offset, &field, sizeof(field));
+                    }
+                template<auto Member>
+                    static void get(const radix_type &radix, std::size_t &offset, T &value)
+                    {
+                        member_type<Member> field;
+                        offset -= sizeof(field);
+                        std::memcpy(&field, radix.data() + offset, sizeof(field));
+                        value.*Member = ordering_default<member_type<Member>>::restore(field);
+                    }
+        };
+
+    /*
+     * Fixed-size occupancy bitmap, next() and prev() find the closest set bit at or after / at or before a position.
+     */
+    template<unsigned int Bits>
+        class bitmap{
+            public:
+                typedef typename std::conditional<(Bits <= 16), std::uint16_t, std::uint64_t>::type word_type;
+                static constexpr unsigned int WORD_BITS = sizeof(word_type) * 8;
+                static constexpr unsigned int WORDS = (Bits + WORD_BITS - 1) / WORD_BITS;
+                static constexpr word_type ALL = (word_type)~(word_type)0;
+
+                word_type words[WORDS];
+
+                void clear()
+                {
+                    for(unsigned int i = 0; i < WORDS; i++)
+                        words[i] = 0;
+                }
+                bool test(unsigned int bit) const
+                {
+                    return ( words[bit / WORD_BITS] >> (bit % WORD_BITS) ) & 1;
+                }
+                void set(unsigned int bit)
+                {
+                    words[bit / WORD_BITS] |= (word_type)1 << (bit % WORD_BITS);
+                }
+                void reset(unsigned int bit)
+                {
+                    words[bit / WORD_BITS] &= (word_type)~( (word_type)1 << (bit % WORD_BITS) );
+                }
+                int next(int bit) const
+                {
+                    if(bit >= (int)Bits) return Bits;
+
+                    unsigned int word = bit / WORD_BITS;
+                    word_type bits = words[word] & (word_type)( ALL << (bit % WORD_BITS) );
+                    while(bits == 0)
+                    {
+                        if(++word == WORDS) return Bits;
+                        bits = words[word];
+                    }
+                    return word * WORD_BITS + std::countr_zero(bits);
+                }
+                int prev(int bit) const
+                {
+                    if(bit < 0) return -1;
+
+                    unsigned int word = bit / WORD_BITS;
+                    word_type bits = words[word] & (word_type)( ALL >> (WORD_BITS - 1 - bit % WORD_BITS) );
+                    while(bits == 0)
+                    {
+                        if(word-- == 0) return -1;
+                        bits = words[word];
+                    }
+                    return word * WORD_BITS + WORD_BITS - 1 - std::countl_zero(bits);
+                }
+        };
+
+    /*
+     * Finds value among the first count entries of a sorted node's tetrades (which has N of them), returning its index
+     * or count when it is not there. Entries beyond count may hold stale tetrades, so matches there are ignored.
+     *
+     * Arrays of 16 tetrades are compared at once with AVX-512, SSE2 or NEON, whichever the compiler targets,
+     * arrays of 4 with SWAR in a single integer. Define ARRAYMAP_NO_SIMD to fall back to a plain loop.
+     */
+    template<class T, unsigned int N>
+        struct tetrade_search{
+            static unsigned int find(const T *tetrades, T value, unsigned int count)
+            {
+                std::uint32_t match = 0;
+                if constexpr(N == 4 && std::endian::native == std::endian::little)
+                {
+                    typedef typename std::conditional<(sizeof(T) == 1), std::uint32_t, std::uint64_t>::type word_type;
+                    constexpr word_type ONES = (word_type)~(word_type)0 / ( ( (word_type)1 << (sizeof(T) * 8) ) - 1 );
+                    constexpr word_type HIGHS = ONES << (sizeof(T) * 8 - 1);
+
+                    word_type word;
+                    std::memcpy(&word, tetrades, sizeof(word));
+                    word ^= ONES * value;
+                    /* Only the lowest flagged entry is sure to be a match, but tetrades are unique anyway. */
+                    word_type zero = (word - ONES) & ~word & HIGHS;
+                    unsigned int i = zero == 0 ? N : std::countr_zero(zero) / (sizeof(T) * 8);
+                    return i < count ? i : count;
+                }
+#if defined(ARRAYMAP_SIMD_X86)
+                else if constexpr(N == 16 && sizeof(T) == 1)
+                {
+                    __m128i entries = _mm_loadu_si128((const __m128i*)tetrades);
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+                    match = _mm_cmpeq_epi8_mask(entries, _mm_set1_epi8((char)value));
+#else
+                    match = _mm_movemask_epi8(_mm_cmpeq_epi8(entries, _mm_set1_epi8((char)value)));
+#endif
+                }
+                else if constexpr(N == 16 && sizeof(T) == 2)
+                {
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+                    match = _mm256_cmpeq_epi16_mask(_mm256_loadu_si256((const __m256i*)tetrades), _mm256_set1_epi16((short)value));
+#else
+                    __m128i needle = _mm_set1_epi16((short)value);
+                    __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)tetrades), needle);
+                    __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(tetrades + 8)), needle);
+                    match = _mm_movemask_epi8(_mm_packs_epi16(low, high));
+#endif
+                }
+#elif defined(ARRAYMAP_SIMD_NEON)
+                else if constexpr(N == 16)
+                {
+                    uint8x16_t equal;
+                    if constexpr(sizeof(T) == 1)
+                        equal = vceqq_u8(vld1q_u8((const std::uint8_t*)tetrades), vdupq_n_u8(value));
+                    else
+                    {
+                        uint16x8_t needle = vdupq_n_u16(value);
+                        equal = vcombine_u8(vmovn_u16(vceqq_u16(vld1q_u16((const std::uint16_t*)tetrades), needle)),
+                                vmovn_u16(vceqq_u16(vld1q_u16((const std::uint16_t*)tetrades + 8), needle)));
+                    }
+                    const uint8x16_t weights = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+                    uint8x16_t bits = vandq_u8(equal, weights);
+                    match = vaddv_u8(vget_low_u8(bits)) | ( vaddv_u8(vget_high_u8(bits)) << 8 );
+                }
+#endif
+                else
+                {
+                    for(unsigned int i = 0; i < count; i++)
+                        if(tetrades[i] == value) return i;
+                    return count;
+                }
+
+                match &= ( (std::uint32_t)1 << count ) - 1;
+                return match == 0 ? count : std::countr_zero(match);
+            }
+        };
+
+    /*
+     * Mapped types for which this is true are stored directly in the leaf nodes instead of being allocated
+     * one by one, specialize it to opt a type in or out.
+     */
+    template<class T>
+        struct inline_value : std::bool_constant<std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(void*)> {};
+
+    /*
+     * Stats policies of an arraymap, which calls their hooks on its hot paths: every node a lookup or insert descends
+     * through (hop), lookups that miss and the level they failed at (miss), nodes taken from and given back to the
+     * pool by kind (clear() and copies report their whole tree at once), nodes erase takes out of the tree (prune)
+     * and every level an iterator looks at while stepping (step).
+     *
+     * The default stats_none does nothing and compiles away. stats_counters counts the events in relaxed atomics,
+     * so they can be read from another thread while the map is in use. Lookups running in parallel may lose a few
+     * counts to each other, that keeps them as cheap as plain increments.
+     */
+    struct stats_none{
+        void hop(unsigned int) const noexcept {}
+        void miss(unsigned int) const noexcept {}
+        void node_allocated(unsigned int, std::size_t) const noexcept {}
+        void node_freed(unsigned int, std::size_t) const noexcept {}
+        void prune(unsigned int) const noexcept {}
+        void step() const noexcept {}
+    };
+    struct stats_counters{
+        static constexpr unsigned int LEVELS = 64;
+        static constexpr unsigned int KINDS = 4;
+        std::atomic<std::uint64_t> hops{};
+        std::atomic<std::uint64_t> misses[LEVELS]{};
+        std::atomic<std::uint64_t> nodes_allocated[KINDS]{};
+        std::atomic<std::uint64_t> nodes_freed[KINDS]{};
+        std::atomic<std::uint64_t> prunes{};
+        std::atomic<std::uint64_t> steps{};
+
+        void hop(unsigned int) noexcept { add(hops, 1); }
+        void miss(unsigned int level) noexcept { add(misses[level < LEVELS ? level : LEVELS - 1], 1); }
+        void node_allocated(unsigned int kind, std::size_t count) noexcept { add(nodes_allocated[kind], count); }
+        void node_freed(unsigned int kind, std::size_t count) noexcept { add(nodes_freed[kind], count); }
+        void prune(unsigned int) noexcept { add(prunes, 1); }
+        void step() noexcept { add(steps, 1); }
+
+        private:
+        static void add(std::atomic<std::uint64_t> &counter, std::uint64_t count) noexcept
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+    };
+
+    /*
+     * Node memory of an arraymap. Nodes are carved out of chunks obtained from a rebound Allocator and are
+     * recycled through an intrusive free list per node kind, so growing and tearing down a tree costs one
+     * allocator call per chunk rather than one per node, and release() hands back every chunk at once.
+     *
+     * Defining ARRAYMAP_HUGE_PAGES makes chunks 2 MiB big, on Linux those of the default allocator are
+     * mapped directly at 2 MiB boundaries and advised to be backed by transparent huge pages. A chunk keeps
+     * its header in its first bytes, so that a whole chunk is exactly one huge page.
+     */
+    template<class Allocator, unsigned int Kinds>
+        class node_pool{
+            public:
+#ifdef ARRAYMAP_HUGE_PAGES
+                static constexpr std::size_t CHUNK_SIZE = 2 << 20;
+#else
+                static constexpr std::size_t CHUNK_SIZE = 64 << 10;
+#endif
+                node_pool(const Allocator &allocator = Allocator()):
+                    chunk_alloc(allocator),
+                    chunks(nullptr),
+                    cursor(nullptr),
+                    limit(nullptr)
+            {
+                for(unsigned int i = 0; i < Kinds; i++)
+                    free_list[i] = nullptr;
+            }
+                node_pool(const node_pool &) = delete;
+                node_pool &operator=(const node_pool &) = delete;
+                ~node_pool()
+                {
+                    release();
+                }
+                void *allocate(unsigned int kind, std::size_t size)
+                {
+                    if(free_list[kind] != nullptr)
+                    {
+                        free_s *node = free_list[kind];
+                        free_list[kind] = node->next;
+                        return node;
+                    }
+
+                    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+                    if(size > CHUNK_SIZE / 4)
+                        return chunk_new(size);
+
+                    if(cursor == nullptr || (std::size_t)(limit - cursor) < size)
+                    {
+                        cursor = (unsigned char*)chunk_new(CHUNK_SIZE - sizeof(chunk_s));
+                        limit = cursor + CHUNK_SIZE - sizeof(chunk_s);
+                    }
+                    void *node = cursor;
+                    cursor += size;
+                    return node;
+                }
+                void deallocate(void *node, unsigned int kind)
+                {
+                    free_s *freed = (free_s*)node;
+                    freed->next = free_list[kind];
+                    free_list[kind] = freed;
+                }
+                void release()
+                {
+                    while(chunks != nullptr)
+                    {
+                        chunk_s *chunk = chunks;
+                        chunks = chunk->next;
+                        chunk_free(chunk);
+                    }
+                    for(unsigned int i = 0; i < Kinds; i++)
+                        free_list[i] = nullptr;
+                    cursor = limit = nullptr;
+                }
+                /*
+                 * Bytes taken from the allocator, used or not.
+                 */
+                std::size_t reserved() const
+                {
+                    std::size_t bytes = 0;
+                    for(const chunk_s *chunk = chunks; chunk != nullptr; chunk = chunk->next)
+                        bytes += chunk->units * sizeof(chunk_s);
+                    return bytes;
+                }
+                /*
+                 * Takes over the chunks and free nodes of other, which must use an equal allocator and is left empty.
+                 */
+                void splice(node_pool &other) noexcept
+                {
+                    if(other.chunks != nullptr)
+                    {
+                        chunk_s *last = other.chunks;
+                        for(; last->next != nullptr; last = last->next);
+                        last->next = chunks;
+                        chunks = other.chunks;
+                    }
+                    for(unsigned int i = 0; i < Kinds; i++)
+                    {
+                        if(other.free_list[i] == nullptr) continue;
+                        free_s *last = other.free_list[i];
+                        for(; last->next != nullptr; last = last->next);
+                        last->next = free_list[i];
+                        free_list[i] = other.free_list[i];
+                        other.free_list[i] = nullptr;
+                    }
+                    other.chunks = nullptr;
+                    other.cursor = other.limit = nullptr;
+                }
+                /*
+                 * Releases everything and takes chunks from allocator from now on.
+                 */
+                void reset(const Allocator &allocator)
+                {
+                    release();
+                    chunk_alloc = chunk_allocator(allocator);
+                }
+                /*
+                 * Exchanges the chunks and free nodes, the allocators stay and must compare equal.
+                 */
+                void swap(node_pool &other) noexcept
+                {
+                    std::swap(chunks, other.chunks);
+                    std::swap(cursor, other.cursor);
+                    std::swap(limit, other.limit);
+                    for(unsigned int i = 0; i < Kinds; i++)
+                        std::swap(free_list[i], other.free_list[i]);
+                }
+
+            private:
+                struct alignas(64) chunk_s{
+                    chunk_s *next;
+                    std::size_t units;
+                };
+                struct free_s{
+                    free_s *next;
+                };
+                typedef typename std::allocator_traits<Allocator>::template rebind_alloc<chunk_s> chunk_allocator;
+                typedef std::allocator_traits<chunk_allocator> chunk_traits;
+
+                static constexpr bool MAP_CHUNKS =
+#if defined(ARRAYMAP_HUGE_PAGES) && defined(__linux__)
+                    std::is_same<chunk_allocator, std::allocator<chunk_s>>::value;
+#else
+                    false;
+#endif
+
+                chunk_allocator chunk_alloc;
+                chunk_s *chunks;
+                unsigned char *cursor;
+                unsigned char *limit;
+                free_s *free_list[Kinds];
+
+                void *chunk_new(std::size_t size)
+                {
+                    std::size_t units = (size + sizeof(chunk_s) - 1) / sizeof(chunk_s) + 1;
+                    chunk_s *chunk;
+#if defined(ARRAYMAP_HUGE_PAGES) && defined(__linux__)
+                    if constexpr(MAP_CHUNKS)
+                    {
+                        /* over-map by one huge page and trim, mmap itself only aligns to base pages */
+                        std::size_t length = (units * sizeof(chunk_s) + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+                        void *mapped = mmap(nullptr, length + CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                        if(mapped == MAP_FAILED)
+                            throw std::bad_alloc();
+                        unsigned char *begin = (unsigned char*)mapped;
+                        unsigned char *aligned = (unsigned char*)(((std::uintptr_t)begin + CHUNK_SIZE - 1) & ~(std::uintptr_t)(CHUNK_SIZE - 1));
+                        if(aligned != begin)
+                            munmap(begin, aligned - begin);
+                        munmap(aligned + length, begin + CHUNK_SIZE - aligned);
+                        madvise(aligned, length, MADV_HUGEPAGE);
+                        units = length / sizeof(chunk_s);
+                        chunk = (chunk_s*)aligned;
+                    }
+                    else
+#endif
+                        chunk = chunk_traits::allocate(chunk_alloc, units);
+
+                    chunk->next = chunks;
+                    chunk->units = units;
+                    chunks = chunk;
+                    return chunk + 1;
+                }
+                void chunk_free(chunk_s *chunk)
+                {
+#if defined(ARRAYMAP_HUGE_PAGES) && defined(__linux__)
+                    if constexpr(MAP_CHUNKS)
+                    {
+                        munmap(chunk, chunk->units * sizeof(chunk_s));
+                        return;
+                    }
+#endif
+                    chunk_traits::deallocate(chunk_alloc, chunk, chunk->units);
+                }
+        };
+
+    template<class _Key, class _Tp, class Ordering, class Allocator, unsigned char RadixBits>
+        class concurrent_arraymap;
+    template<class _Key, class _Tp, class Ordering, class Allocator, unsigned char RadixBits, unsigned char ShardDigits>
+        class sharded_arraymap;
+    template<class _Key, class _Tp, class Ordering, unsigned char RadixBits, bool Counted>
+        class mapped_arraymap;
+
     template<
         class _Key,
               class _Tp,
               class Ordering = ordering_default<_Key>,
-              class Allocator = std::allocator<_Tp>
+              class Allocator = std::allocator<_Tp>,
+              unsigned char RadixBits = 4,
+              class Stats = stats_none,
+              bool Counted = false
                   >
                   class arraymap{
                       public:
                           typedef _Key    key_type;
                           typedef _Tp     mapped_type;
                           typedef Ordering ordering_elem;
+                          typedef typename ordering_radix<_Key, Ordering>::type radix_type;
                           typedef std::pair<key_type, mapped_type> value_type;
                           typedef std::pair<key_type, std::reference_wrapper<mapped_type>> reference;
                           typedef std::size_t size_type;
                           typedef Allocator allocator_type;
+                          typedef Stats stats_type;
+                          static constexpr unsigned char radix_bits = RadixBits;
                           class iterator;
                           class reverse_iterator;
                           class const_iterator;
                           class const_reverse_iterator;
 
                       private:
-                          static_assert(std::is_trivially_copyable<key_type>::value, "Arraymap requires key type to be trivially copyable! (std::is_trivially_copyable)");
+                          template<class, class, class, class, unsigned char>
+                              friend class concurrent_arraymap;
+                          template<class, class, class, class, unsigned char, unsigned char>
+                              friend class sharded_arraymap;
+                          template<class, class, class, unsigned char, bool>
+                              friend class mapped_arraymap;
+                          template<class K, class T, class O, class A, unsigned char R, class S, bool C>
+                              friend arraymap<K, T, O, A, R, S, C> set_intersection(const arraymap<K, T, O, A, R, S, C> &, const arraymap<K, T, O, A, R, S, C> &);
+                          template<class K, class T, class O, class A, unsigned char R, class S, bool C>
+                              friend arraymap<K, T, O, A, R, S, C> set_union(const arraymap<K, T, O, A, R, S, C> &, const arraymap<K, T, O, A, R, S, C> &);
+                          template<class K, class T, class O, class A, unsigned char R, class S, bool C>
+                              friend arraymap<K, T, O, A, R, S, C> set_difference(const arraymap<K, T, O, A, R, S, C> &, const arraymap<K, T, O, A, R, S, C> &);
+                          static_assert(std::is_trivially_copyable<radix_type>::value, "Arraymap requires key type (or the radix type of its ordering) to be trivially copyable! (std::is_trivially_copyable)");
+                          struct node_s;
                           union ptr_s{
                               mapped_type *val;
-                              union ptr_s *next;
+                              struct node_s *next;
                               bool operator==(const union ptr_s &p) const
                               { return next == p.next; };
                               bool operator!=(const union ptr_s &p) const
                               { return next != p.next; };
                           };
-                          static inline union ptr_s empty_node[0x10];
-                          static constexpr unsigned short MAX_DEPTH = sizeof(key_type) * 2;
-                          static inline Allocator alloc;
+
+                          static_assert(RadixBits == 4 || RadixBits == 8 || RadixBits == 16, "Arraymap supports 4, 8 or 16 radix bits per level!");
+                          static_assert(sizeof(radix_type) * 8 % RadixBits == 0, "Arraymap requires key size to be a multiple of the radix width!");
+
+                          /*
+                           * Keys are split into tetrades of RADIX_BITS bits (4 by default, hence the name), one per level,
+                           * starting from the least significant one at level 0.
+                           */
+                          static constexpr unsigned int RADIX_BITS = RadixBits;
+                          static constexpr unsigned int FANOUT = 1u << RADIX_BITS;
+                          static constexpr unsigned short MAX_DEPTH = sizeof(radix_type) * 8 / RADIX_BITS;
+                          typedef typename std::conditional<(RADIX_BITS > 8), std::uint16_t, unsigned char>::type tetrade_type;
+                          typedef typename std::conditional<(RADIX_BITS < 8), unsigned char, std::uint32_t>::type count_type;
+
+                          /*
+                           * A small node holds up to SMALL_NODE_SIZE children sorted by tetrade and is searched linearly,
+                           * a full node holds all FANOUT children and is indexed directly. With wide radixes a medium
+                           * node of MEDIUM_NODE_SIZE sorted children sits in between.
+                           * Every node starts out small, grows into the next kind when it runs out of room and shrinks
+                           * back once erasing brings it down to a few children less than the smaller kind holds.
+                           *
+                           * Full nodes also keep an occupancy bitmap, so finding their next or previous child never scans
+                           * empty slots. Sorted nodes need none, their tetrades already are in order.
+                           *
+                           * Paths are compressed: a node's children are indexed by the tetrade at its own level, which can
+                           * be several levels below its parent's. prefix holds a key of the node's subtree, so every tetrade
+                           * above level (the skipped ones included) is known, and chains of single-child nodes never exist.
+                           */
+                          enum node_kind : unsigned char { NODE_SMALL, NODE_MEDIUM, NODE_FULL, NODE_LEAF };
+                          static constexpr unsigned int SMALL_NODE_SIZE = 4;
+                          static constexpr unsigned int MEDIUM_NODE_SIZE = 16;
+                          static constexpr bool HAS_MEDIUM_NODE = FANOUT > MEDIUM_NODE_SIZE;
+                          static constexpr unsigned int SHRINK_NODE_SIZE = SMALL_NODE_SIZE - 1;
+                          static constexpr unsigned int SHRINK_MEDIUM_NODE_SIZE = MEDIUM_NODE_SIZE - 4;
+
+                          /*
+                           * With Counted the nodes above level 0 also keep the number of elements below each child, in
+                           * the same order as the children, for rank() and select().
+                           */
+                          static constexpr bool COUNTED = Counted;
+                          template<unsigned int N, bool = COUNTED>
+                              struct counts_s{
+                                  size_type size[N];
+                              };
+                          template<unsigned int N>
+                              struct counts_s<N, false>{};
+                          struct node_s{
+                              node_kind kind;
+                              unsigned char level;
+                              count_type count;
+                              unsigned char prefix[sizeof(radix_type)];
+                          };
+                          template<unsigned int N>
+                              struct sorted_node_s : node_s{
+                                  tetrade_type tetrades[N];
+                                  union ptr_s child[N];
+                                  [[no_unique_address]] counts_s<N> counts;
+                              };
+                          typedef sorted_node_s<SMALL_NODE_SIZE> small_node_s;
+                          typedef sorted_node_s<MEDIUM_NODE_SIZE> medium_node_s;
+                          struct full_node_s : node_s{
+                              bitmap<FANOUT> mask;
+                              union ptr_s child[FANOUT];
+                              [[no_unique_address]] counts_s<FANOUT> counts;
+                          };
+
+                          /*
+                           * With INLINE_VALUES every level 0 node is a leaf node holding the values themselves next to
+                           * an occupancy bitmap. Leaf nodes never grow or shrink, so values never move once added.
+                           * Empty mapped types (arrayset's) take no room at all, their leaves are just the bitmap.
+                           */
+                          static constexpr bool INLINE_VALUES = inline_value<mapped_type>::value && RADIX_BITS <= 8;
+                          static constexpr node_kind LEAF_KIND = INLINE_VALUES ? NODE_LEAF : NODE_SMALL;
+                          static constexpr bool EMPTY_VALUES = INLINE_VALUES && std::is_empty<mapped_type>::value;
+                          struct leaf_node_s : node_s{
+                              bitmap<FANOUT> mask;
+                              alignas(mapped_type) unsigned char values[EMPTY_VALUES ? 1 : FANOUT * sizeof(mapped_type)];
+                          };
+                          static mapped_type *leaf_slot(const leaf_node_s *leaf, tetrade_type tetrade)
+                          {
+                              return (mapped_type*)leaf->values + (EMPTY_VALUES ? 0 : tetrade);
+                          }
+                          static_assert(SMALL_NODE_SIZE == 4, "empty_node initializer assumes 4 children per small node!");
+                          static inline small_node_s empty_node = { {NODE_SMALL, 0, 0, {}}, {},
+                              { {.next = &arraymap::empty_node}, {.next = &arraymap::empty_node}, {.next = &arraymap::empty_node}, {.next = &arraymap::empty_node} }, {} };
+                          typedef std::allocator_traits<Allocator> alloc_traits;
+                          static constexpr bool STATS = !std::is_same<Stats, stats_none>::value;
+
+                          /*
+                           * What the value of an iterator off any element (end() or one of a missed find) refers to, so
+                           * that making one does not construct a mapped_type each time. Dereferencing such an iterator
+                           * is invalid, but if mapped_type is default constructible it still reads a default value,
+                           * made once and shared by every map of the type, which must not be written. Otherwise it is
+                           * storage that never holds an object.
+                           */
+                          static mapped_type &unbound_value() noexcept
+                          {
+                              if constexpr(std::is_default_constructible<mapped_type>::value)
+                              {
+                                  static const mapped_type value{};
+                                  return const_cast<mapped_type&>(value);
+                              }
+                              else
+                              {
+                                  alignas(mapped_type) static unsigned char storage[sizeof(mapped_type)];
+                                  return *(mapped_type*)storage;
+                              }
+                          }
 
                           class iterator_base{
+                              friend class arraymap;
                               protected:
+                                  arraymap *map;
                                   union ptr_s *stack[MAX_DEPTH];
+                                  std::size_t version;
                                   short depth;
-                                  unsigned char key_bytes[sizeof(key_type) + 1];
-                                  mapped_type empty_element;
+                                  unsigned char key_bytes[sizeof(radix_type) + 1];
                                   reference currentValue;
 
-                                  iterator_base(union ptr_s *root):
-                                      currentValue(*(key_type*)iterator_base::key_bytes, empty_element) 
+                                  iterator_base(const arraymap *owner):
+                                      map(const_cast<arraymap*>(owner)),
+                                      version(owner->version),
+                                      currentValue(Ordering::restore(radix_type{}), unbound_value())
                               {
-                                  stack[MAX_DEPTH - 1] = root;
+                                  stack[MAX_DEPTH - 1] = &map->root;
                               }
-                                  iterator_base(union ptr_s *root,const key_type &key):
-                                      iterator_base(root)
+                                  iterator_base(const arraymap *owner, const radix_type &key):
+                                      iterator_base(owner)
                               {
-                                  std::memcpy(key_bytes, &key, sizeof(key_type));
-                                  key_bytes[sizeof(key_type)] = 0;
-                                  fill_ptr_stack();
-                                  for(depth = MAX_DEPTH - 1 ; depth > 0 && *stack[depth] != *empty_node ; depth--);
-
-                                  if(target_valid())
+                                  seek(key);
+                              }
+                                  void seek(const radix_type &key)
                                   {
-                                      currentValue.first = Ordering::restore(key);
-                                      currentValue.second = *stack[0]->next[tetradeValue(key_bytes, 0)].val;
+                                      std::memcpy(key_bytes, &key, sizeof(radix_type));
+                                      key_bytes[sizeof(radix_type)] = 0;
+                                      depth = fill_ptr_stack();
+
+                                      if(target_valid())
+                                          update_value();
+                                      else
+                                          map->hooks.miss(depth);
                                   }
-                              }
+                                  /*
+                                   * Positions on key, constructing its value from args first if it is missing, and returns
+                                   * whether it was added. The stack is only walked from level down, so the entries above
+                                   * it must already be on key's path, as they are after copying those of an iterator
+                                   * to a key that shares every tetrade above level.
+                                   */
+                                  template<class... Args>
+                                      bool emplace_elem(const radix_type &key, short level, Args&&... args)
+                                      {
+                                          std::memcpy(key_bytes, &key, sizeof(radix_type));
+                                          key_bytes[sizeof(radix_type)] = 0;
+                                          depth = fill_ptr_stack(level);
+                                          if(target_valid())
+                                          {
+                                              update_value();
+                                              return false;
+                                          }
+
+                                          level = depth;
+                                          std::construct_at(map->element_fast_slot(key_bytes, stack[level]), std::forward<Args>(args)...);
+                                          map->element_count++;
+                                          depth = fill_ptr_stack(level);
+                                          update_value();
+                                          return true;
+                                      }
                                   bool target_valid()
                                   {
-                                      return (depth == 0) && ( stack[0]->next[tetradeValue(key_bytes, 0)] != *empty_node );
+                                      return (depth == 0) && leaf_value(stack[0]->next, tetradeValue(key_bytes, 0)) != nullptr;
                                   }
-                                  void fill_ptr_stack()
+                                  void update_value()
                                   {
-                                      union ptr_s *current_Node = stack[MAX_DEPTH-1];
-                                      unsigned int tetradeNr =  MAX_DEPTH - 2;
-                                      do{
-                                          current_Node = ( current_Node->next + tetradeValue(key_bytes, tetradeNr+1));
-                                          stack[tetradeNr] = current_Node;
-                                      }while(tetradeNr-- > 0);
+                                      currentValue.first = Ordering::restore( (radix_type) *( (radix_type*) key_bytes ) ); 
+                                      currentValue.second = *leaf_value(stack[0]->next, tetradeValue(key_bytes, 0));
                                   }
-                                  static int incrQuartet(unsigned char *bytes, unsigned int quartetNr)
+                                  /*
+                                   * Walks down along key_bytes for as long as the path exists and returns the level it stopped at.
+                                   * Nodes move when they grow, shrink or get freed, so the stack is refilled this way whenever
+                                   * the map's version no longer matches the one the stack was built against.
+                                   *
+                                   * Every level gets a stack entry, levels skipped by a compressed path share the slot of the
+                                   * node below them and behave like a node with a single child (see level_child).
+                                   */
+                                  short fill_ptr_stack(short level = MAX_DEPTH - 1)
                                   {
-                                      if(quartetNr > MAX_DEPTH) return 0;
-                                      bytes[(quartetNr) >> 1] += 1 << ( ( quartetNr) & 1 ) * 4;
-
-                                      if( ( (bytes[( quartetNr >> 1 )] >> ( quartetNr & 1 ) * 4 ) ) == 0 )
-                                          return !(quartetNr & 1) + 1 + incrQuartet(bytes, quartetNr + 1 + !(quartetNr & 1));
-
-                                      return ( (bytes[( quartetNr >> 1 )] >> ( quartetNr & 1 ) * 4)  & 0xF )  == 0;
+                                      version = map->version;
+                                      for(; level > 0; level--)
+                                      {
+                                          map->hooks.hop(level);
+                                          union ptr_s *child = level_child(stack[level], level, tetradeValue(key_bytes, level));
+                                          if(is_empty(*child)) break;
+                                          stack[level - 1] = child;
+                                      }
+                                      return level;
                                   }
-                                  static int decrQuartet(unsigned char *bytes, unsigned int quartetNr)
+                                  void descend_first(short level)
                                   {
-                                      if(quartetNr > MAX_DEPTH) return 0;
-                                      bytes[(quartetNr) >> 1] -= 1 << ( ( quartetNr) & 1 ) * 4;
-
-                                      if( ( (bytes[( quartetNr >> 1 )] >> ( ( quartetNr & 1 ) * 4 )) ) == ( 0xFF >> ( (quartetNr & 1 ) * 4 ) ))
-                                          return !(quartetNr & 1) + 1 + decrQuartet(bytes, quartetNr + 1 + !(quartetNr & 1 ));
-
-                                      return ( (bytes[( quartetNr >> 1 )] >> ( quartetNr & 1 ) * 4)  & 0xF )  == 0xF;
+                                      for(; level > 0; level--)
+                                      {
+                                          map->hooks.step();
+                                          stack[level - 1] = level_child(stack[level], level, tetradeValue(key_bytes, level));
+                                          setTetrade(key_bytes, level - 1, level_next_tetrade(stack[level - 1], level - 1, 0));
+                                      }
+                                      depth = 0;
+                                      update_value();
                                   }
-                                  void increment()
+                                  void descend_last(short level)
                                   {
-                                      while(depth < MAX_DEPTH){
-                                          if((depth != 0) && stack[depth]->next[tetradeValue(key_bytes, depth)] != *empty_node)
-                                          {
-                                              stack[depth-1] = stack[depth]->next + tetradeValue(key_bytes, depth);
-                                              depth--;
-                                          }
-                                          else 
-                                              depth += incrQuartet(key_bytes, depth);
-
-                                          if( (depth == 0) && ( stack[0]->next[tetradeValue(key_bytes,0)] != *empty_node ) )
-                                          {
-                                              currentValue.first = Ordering::restore( (key_type) *( (key_type*) key_bytes ) ); 
-                                              currentValue.second = *stack[0]->next[tetradeValue(key_bytes,0)].val;
-                                              return;
-                                          }
-                                      }
-
-                                      if(key_bytes[sizeof(key_type)] == 0xFF)
+                                      for(; level > 0; level--)
                                       {
-                                          key_bytes[sizeof(key_type)] = 0x00;
-                                          memset(key_bytes, 0x00, sizeof(key_type));
-                                          depth = MAX_DEPTH - 1;
-                                          increment();
-                                          return;
+                                          map->hooks.step();
+                                          stack[level - 1] = level_child(stack[level], level, tetradeValue(key_bytes, level));
+                                          setTetrade(key_bytes, level - 1, level_prev_tetrade(stack[level - 1], level - 1, FANOUT - 1));
                                       }
-                                      memset(key_bytes, 0, sizeof(key_type));
-                                      key_bytes[sizeof(key_type)] = 1;
-                                      return;
+                                      depth = 0;
+                                      update_value();
                                   }
-                                  void decrement()
+                                  void step_forward(short level)
                                   {
-                                      while(depth < MAX_DEPTH){
-                                          if((depth != 0) && stack[depth]->next[tetradeValue(key_bytes, depth)] != *empty_node)
-                                          {
-                                              stack[depth-1] = stack[depth]->next + tetradeValue(key_bytes, depth);
-                                              depth--;
-                                          }
-                                          else 
-                                              depth += decrQuartet(key_bytes, depth);
-
-                                          if( (depth == 0) && ( stack[0]->next[tetradeValue(key_bytes,0)] != *empty_node ) )
+                                      for(; level < MAX_DEPTH; level++)
+                                      {
+                                          map->hooks.step();
+                                          int tetrade = level_next_tetrade(stack[level], level, tetradeValue(key_bytes, level) + 1);
+                                          if(tetrade < (int)FANOUT)
                                           {
-                                              currentValue.first = Ordering::restore( (key_type) *( (key_type*) key_bytes ) ); 
-                                              currentValue.second = *stack[0]->next[tetradeValue(key_bytes,0)].val;
+                                              setTetrade(key_bytes, level, tetrade);
+                                              descend_first(level);
                                               return;
                                           }
                                       }
-
-                                      if(key_bytes[sizeof(key_type)] == 0x01)
-                                      {
-                                          key_bytes[sizeof(key_type)] = 0x00;
-                                          memset(key_bytes, 0xFF, sizeof(key_type));
-                                          depth = MAX_DEPTH - 1;
-                                          decrement();
-                                          return;
-                                      }
-                                      memset(key_bytes, 0, sizeof(key_type));
-                                      key_bytes[sizeof(key_type)] = 0xFF;
-                                      return;
+                                      memset(key_bytes, 0, sizeof(radix_type));
+                                      key_bytes[sizeof(radix_type)] = 1;
+                                      depth = MAX_DEPTH;
                                   }
-                                  bool erase_elem()
+                                  void step_backward(short level)
                                   {
-                                      if(depth == 0)
+                                      for(; level < MAX_DEPTH; level++)
                                       {
-                                          if(( stack[0]->next[tetradeValue(key_bytes,0)] != *empty_node ))
-                                          {
-                                              std::destroy_at(stack[0]->next[tetradeValue(key_bytes,0)].val);
-                                              alloc.deallocate(stack[0]->next[tetradeValue(key_bytes,0)].val, 1);
-                                              stack[0]->next[tetradeValue(key_bytes,0)].next = empty_node->next;
-                                          }
-                                          else return false;
-
-                                          for(; depth < MAX_DEPTH; depth++)
+                                          map->hooks.step();
+                                          int tetrade = level_prev_tetrade(stack[level], level, tetradeValue(key_bytes, level) - 1);
+                                          if(tetrade >= 0)
                                           {
-                                              if(is_node_empty(*stack[depth]))
-                                              {
-                                                  delete[] stack[depth]->next;
-                                                  stack[depth]->next = empty_node->next;
-                                              }
-                                              else break;
+                                              setTetrade(key_bytes, level, tetrade);
+                                              descend_last(level);
+                                              return;
                                           }
-                                          return true;
                                       }
-                                      return false;
-                                  }
-                              public:
-                                  reference *operator->() 
-                                  {
-                                      return &currentValue;
-                                  }
-                                  reference operator*() 
-                                  {
-                                      return currentValue;
-                                  }
-                                  bool operator==(const iterator_base &p) const
-                                  {
-                                      return std::memcmp(key_bytes, p.key_bytes, sizeof(key_type)+1) == 0;
-                                  }
-                                  bool operator!=(const iterator_base &p) const
-                                  {
-                                      return std::memcmp(key_bytes, p.key_bytes, sizeof(key_type)+1) != 0;
-                                  }
-                          };
-
-                          class const_iterator_base{
-                              protected:
-                                  const union ptr_s *stack[MAX_DEPTH];
-                                  short depth;
-                                  unsigned char key_bytes[sizeof(key_type) + 1];
-                                  mapped_type empty_element;
-                                  reference currentValue;
-
-                                  const_iterator_base(const union ptr_s *root):
-                                      currentValue(*(key_type*)const_iterator_base::key_bytes, empty_element) 
-                              {
-                                  stack[MAX_DEPTH - 1] = root;
-                              }
-                                  const_iterator_base(const union ptr_s *root, key_type &key):
-                                      const_iterator_base(root)
-                              {
-                                  std::memcpy(key_bytes, &key, sizeof(key_type));
-                                  key_bytes[sizeof(key_type)] = 0;
-                                  fill_ptr_stack();
-                                  for(depth = MAX_DEPTH - 1 ; depth > 0 && *stack[depth] != *empty_node ; depth--);
-
-                                  if(target_valid())
-                                  {
-                                      currentValue.first = Ordering::restore(key);
-                                      currentValue.second = *stack[0]->next[tetradeValue(key_bytes, 0)].val;
-                                  }
-                              }
-                                  bool target_valid()
-                                  {
-                                      return (depth == 0) && ( stack[0]->next[tetradeValue(key_bytes, 0)] != *empty_node );
+                                      memset(key_bytes, 0, sizeof(radix_type));
+                                      key_bytes[sizeof(radix_type)] = 0xFF;
+                                      depth = MAX_DEPTH;
                                   }
-                                  void fill_ptr_stack()
+                                  /*
+                                   * Position on the first or last element straight from the root, only ever following
+                                   * populated children.
+                                   */
+                                  void seek_first()
                                   {
-                                      const union ptr_s *current_Node = stack[MAX_DEPTH-1];
-                                      unsigned int tetradeNr =  MAX_DEPTH - 2;
-                                      do{
-                                          current_Node = ( current_Node->next + tetradeValue(key_bytes, tetradeNr+1));
-                                          stack[tetradeNr] = current_Node;
-                                      }while(tetradeNr-- > 0);
+                                      memset(key_bytes, 0, sizeof(radix_type) + 1);
+                                      version = map->version;
+                                      int tetrade = level_next_tetrade(stack[MAX_DEPTH - 1], MAX_DEPTH - 1, 0);
+                                      if(tetrade < (int)FANOUT)
+                                      {
+                                          setTetrade(key_bytes, MAX_DEPTH - 1, tetrade);
+                                          descend_first(MAX_DEPTH - 1);
+                                          return;
+                                      }
+                                      key_bytes[sizeof(radix_type)] = 1;
+                                      depth = MAX_DEPTH;
                                   }
-                                  static int incrQuartet(unsigned char *bytes, unsigned int quartetNr)
+                                  void seek_last()
                                   {
-                                      if(quartetNr > MAX_DEPTH) return 0;
-                                      bytes[(quartetNr) >> 1] += 1 << ( ( quartetNr) & 1 ) * 4;
-
-                                      if( ( (bytes[( quartetNr >> 1 )] >> ( quartetNr & 1 ) * 4 ) ) == 0 )
-                                          return !(quartetNr & 1) + 1 + incrQuartet(bytes, quartetNr + 1 + !(quartetNr & 1));
-
-                                      return ( (bytes[( quartetNr >> 1 )] >> ( quartetNr & 1 ) * 4)  & 0xF )  == 0;
+                                      memset(key_bytes, 0, sizeof(radix_type) + 1);
+                                      version = map->version;
+                                      int tetrade = level_prev_tetrade(stack[MAX_DEPTH - 1], MAX_DEPTH - 1, FANOUT - 1);
+                                      if(tetrade >= 0)
+                                      {
+                                          setTetrade(key_bytes, MAX_DEPTH - 1, tetrade);
+                                          descend_last(MAX_DEPTH - 1);
+                                          return;
+                                      }
+                                      key_bytes[sizeof(radix_type)] = 0xFF;
+                                      depth = MAX_DEPTH;
                                   }
-                                  static int decrQuartet(unsigned char *bytes, unsigned int quartetNr)
+                                  void increment()
                                   {
-                                      if(quartetNr > MAX_DEPTH) return 0;
-                                      bytes[(quartetNr) >> 1] -= 1 << ( ( quartetNr) & 1 ) * 4;
+                                      if(key_bytes[sizeof(radix_type)] == 0x01)
+                                          return;
 
-                                      if( ( (bytes[( quartetNr >> 1 )] >> ( ( quartetNr & 1 ) * 4 )) ) == ( 0xFF >> ( (quartetNr & 1 ) * 4 ) ))
-                                          return !(quartetNr & 1) + 1 + decrQuartet(bytes, quartetNr + 1 + !(quartetNr & 1 ));
+                                      if(key_bytes[sizeof(radix_type)] == 0xFF)
+                                      {
+                                          seek_first();
+                                          return;
+                                      }
+                                      if(version != map->version)
+                                          depth = fill_ptr_stack();
 
-                                      return ( (bytes[( quartetNr >> 1 )] >> ( quartetNr & 1 ) * 4)  & 0xF )  == 0xF;
+                                      step_forward(depth);
                                   }
-                                  void increment()
+                                  void decrement()
                                   {
-                                      while(depth < MAX_DEPTH)
-                                      {
-                                          if((depth != 0) && stack[depth]->next[tetradeValue(key_bytes, depth)] != *empty_node)
-                                          {
-                                              stack[depth-1] = stack[depth]->next + tetradeValue(key_bytes, depth);
-                                              depth--;
-                                          }
-                                          else 
-                                              depth += incrQuartet(key_bytes, depth);
-
-                                          if( (depth == 0) && ( stack[0]->next[tetradeValue(key_bytes,0)] != *empty_node ) )
-                                          {
-                                              currentValue.first = Ordering::restore( (key_type) *( (key_type*) key_bytes ) ); 
-                                              currentValue.second = *stack[0]->next[tetradeValue(key_bytes,0)].val;
-                                              return;
-                                          }
-                                      }
+                                      if(key_bytes[sizeof(radix_type)] == 0xFF)
+                                          return;
 
-                                      if(key_bytes[sizeof(key_type)] == 0xFF)
+                                      if(key_bytes[sizeof(radix_type)] == 0x01)
                                       {
-                                          key_bytes[sizeof(key_type)] = 0x00;
-                                          memset(key_bytes, 0x00, sizeof(key_type));
-                                          depth = MAX_DEPTH - 1;
-                                          increment();
+                                          seek_last();
                                           return;
                                       }
-                                      memset(key_bytes, 0, sizeof(key_type));
-                                      key_bytes[sizeof(key_type)] = 1;
-                                      return;
+                                      if(version != map->version)
+                                          depth = fill_ptr_stack();
+
+                                      step_backward(depth);
                                   }
-                                  void decrement()
+                                  bool erase_elem()
                                   {
-                                      while(depth < MAX_DEPTH)
-                                      {
-                                          if((depth != 0) && stack[depth]->next[tetradeValue(key_bytes, depth)] != *empty_node)
-                                          {
-                                              stack[depth-1] = stack[depth]->next + tetradeValue(key_bytes, depth);
-                                              depth--;
-                                          }
-                                          else 
-                                              depth += decrQuartet(key_bytes, depth);
+                                      if(version != map->version)
+                                          depth = fill_ptr_stack();
 
-                                          if( (depth == 0) && ( stack[0]->next[tetradeValue(key_bytes,0)] != *empty_node ) )
-                                          {
-                                              currentValue.first = Ordering::restore( (key_type) *( (key_type*) key_bytes ) ); 
-                                              currentValue.second = *stack[0]->next[tetradeValue(key_bytes,0)].val;
-                                              return;
-                                          }
-                                      }
+                                      if(!target_valid())
+                                          return false;
 
-                                      if(key_bytes[sizeof(key_type)] == 0x01)
+                                      if constexpr(COUNTED)
+                                          map->count_path(key_bytes, -1);
+                                      union ptr_s *slot = stack[0];
+                                      mapped_type *value = leaf_value(slot->next, tetradeValue(key_bytes, 0));
+                                      std::destroy_at(value);
+                                      if constexpr(!INLINE_VALUES)
+                                          map->alloc.deallocate(value, 1);
+                                      map->node_remove_child(slot, tetradeValue(key_bytes, 0));
+                                      if(is_empty(*slot))
+                                          map->hooks.prune(0);
+
+                                      for(short level = 1; level < MAX_DEPTH && is_empty(*slot); level++)
                                       {
-                                          key_bytes[sizeof(key_type)] = 0x00;
-                                          memset(key_bytes, 0xFF, sizeof(key_type));
-                                          depth = MAX_DEPTH - 1;
-                                          decrement();
-                                          return;
+                                          if(stack[level] == slot) continue;
+                                          slot = stack[level];
+                                          const node_s *node = slot->next;
+                                          map->node_remove_child(slot, tetradeValue(key_bytes, level));
+                                          if(is_empty(*slot) || slot->next->level < node->level)
+                                              map->hooks.prune(node->level);
                                       }
-                                      memset(key_bytes, 0, sizeof(key_type));
-                                      key_bytes[sizeof(key_type)] = 0xFF;
-                                      return;
+                                      return true;
                                   }
                               public:
                                   reference *operator->() 
@@ -479,13 +1041,13 @@ namespace arraymap{
                                   {
                                       return currentValue;
                                   }
-                                  bool operator==(const const_iterator_base &p) const
+                                  bool operator==(const iterator_base &p) const
                                   {
-                                      return std::memcmp(key_bytes, p.key_bytes, sizeof(key_type)+1) == 0;
+                                      return std::memcmp(key_bytes, p.key_bytes, sizeof(radix_type)+1) == 0;
                                   }
-                                  bool operator !=(const const_iterator_base &p) const
+                                  bool operator!=(const iterator_base &p) const
                                   {
-                                      return std::memcmp(key_bytes, p.key_bytes, sizeof(key_type)+1) != 0;
+                                      return std::memcmp(key_bytes, p.key_bytes, sizeof(radix_type)+1) != 0;
                                   }
                           };
 
@@ -493,27 +1055,27 @@ namespace arraymap{
                           class iterator : public iterator_base{
                               private:
                                   friend class arraymap;
-                                  iterator(union ptr_s *root, key_type key, bool findNext):
-                                      iterator_base(root, key)
+                                  iterator(arraymap *owner, radix_type key, bool findNext):
+                                      iterator_base(owner, key)
                               {
                                   if(!iterator_base::target_valid())
                                   {
                                       if(findNext)
                                       {
-                                          operator++();
+                                          iterator_base::step_forward(iterator_base::depth);
                                       }else
                                       {
-                                          memset(iterator_base::key_bytes, 0, sizeof(key_type));
-                                          iterator_base::key_bytes[sizeof(key_type)] = 1;
+                                          memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                          iterator_base::key_bytes[sizeof(radix_type)] = 1;
                                           iterator_base::depth = MAX_DEPTH;
                                       }
                                   }
                               }
-                                  iterator(union ptr_s *root):
-                                      iterator_base(root)
+                                  iterator(arraymap *owner):
+                                      iterator_base(owner)
                               {
-                                  memset(iterator_base::key_bytes, 0, sizeof(key_type));
-                                  iterator_base::key_bytes[sizeof(key_type)] = 1;
+                                  memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                  iterator_base::key_bytes[sizeof(radix_type)] = 1;
                                   iterator_base::depth = MAX_DEPTH;
                               }
                               public:
@@ -544,27 +1106,27 @@ namespace arraymap{
                           class reverse_iterator : public iterator_base{
                               private:
                                   friend class arraymap;
-                                  reverse_iterator(union ptr_s *root, key_type key, bool findNext):
-                                      iterator_base(root, key)
+                                  reverse_iterator(arraymap *owner, radix_type key, bool findNext):
+                                      iterator_base(owner, key)
                               {
                                   if(!iterator_base::target_valid()){
                                       if(findNext)
                                       {
-                                          operator++();
+                                          iterator_base::step_backward(iterator_base::depth);
                                       }else
                                       {
 
-                                          memset(iterator_base::key_bytes, 0, sizeof(key_type));
-                                          iterator_base::key_bytes[sizeof(key_type)] = 0xFF;
+                                          memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                          iterator_base::key_bytes[sizeof(radix_type)] = 0xFF;
                                           iterator_base::depth = MAX_DEPTH;
                                       }
                                   }
                               }
-                                  reverse_iterator(union ptr_s *root):
-                                      iterator_base(root)
+                                  reverse_iterator(arraymap *owner):
+                                      iterator_base(owner)
                               {
-                                  memset(iterator_base::key_bytes, 0, sizeof(key_type));
-                                  iterator_base::key_bytes[sizeof(key_type)] = 0xFF;
+                                  memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                  iterator_base::key_bytes[sizeof(radix_type)] = 0xFF;
                                   iterator_base::depth = MAX_DEPTH;
                               }
                               public:
@@ -592,30 +1154,30 @@ namespace arraymap{
                                   }
                           };
 
-                          class const_iterator : public const_iterator_base{
+                          class const_iterator : public iterator_base{
                               private:
                                   friend class arraymap;
-                                  const_iterator(const union ptr_s *root, key_type key, bool findNext):
-                                      const_iterator_base(root, key)
+                                  const_iterator(const arraymap *owner, radix_type key, bool findNext):
+                                      iterator_base(owner, key)
                               {
-                                  if(!const_iterator_base::target_valid()){
+                                  if(!iterator_base::target_valid()){
                                       if(findNext)
                                       {
-                                          operator++();
+                                          iterator_base::step_forward(iterator_base::depth);
                                       }else
                                       {
-                                          memset(const_iterator_base::key_bytes, 0, sizeof(key_type));
-                                          const_iterator_base::key_bytes[sizeof(key_type)] = 1;
-                                          const_iterator_base::depth = MAX_DEPTH;
+                                          memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                          iterator_base::key_bytes[sizeof(radix_type)] = 1;
+                                          iterator_base::depth = MAX_DEPTH;
                                       }
                                   }
                               }
-                                  const_iterator(union ptr_s *root):
-                                      const_iterator_base(root)
+                                  const_iterator(const arraymap *owner):
+                                      iterator_base(owner)
                               {
-                                  memset(const_iterator_base::key_bytes, 0, sizeof(key_type));
-                                  const_iterator_base::key_bytes[sizeof(key_type)] = 1;
-                                  const_iterator_base::depth = MAX_DEPTH;
+                                  memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                  iterator_base::key_bytes[sizeof(radix_type)] = 1;
+                                  iterator_base::depth = MAX_DEPTH;
                               }
                               public:
                                   const_iterator operator--(int)
@@ -626,7 +1188,7 @@ namespace arraymap{
                                   }
                                   const_iterator& operator--()
                                   {
-                                      const_iterator_base::decrement();
+                                      iterator_base::decrement();
                                       return *this;
                                   }
                                   const_iterator operator++(int)
@@ -637,35 +1199,35 @@ namespace arraymap{
                                   }
                                   const_iterator& operator++()
                                   {
-                                      const_iterator_base::increment();
+                                      iterator_base::increment();
                                       return *this;
                                   }
                           };
 
-                          class const_reverse_iterator : public const_iterator_base{
+                          class const_reverse_iterator : public iterator_base{
                               private:
                                   friend class arraymap;
-                                  const_reverse_iterator(const union ptr_s *root, key_type key, bool findNext):
-                                      const_iterator_base(root, key)
+                                  const_reverse_iterator(const arraymap *owner, radix_type key, bool findNext):
+                                      iterator_base(owner, key)
                               {
-                                  if(!const_iterator_base::target_valid()){
+                                  if(!iterator_base::target_valid()){
                                       if(findNext)
                                       {
-                                          operator++();
+                                          iterator_base::step_backward(iterator_base::depth);
                                       }else
                                       {
-                                          memset(const_iterator_base::key_bytes, 0, sizeof(key_type));
-                                          const_iterator_base::key_bytes[sizeof(key_type)] = 0xFF;
-                                          const_iterator_base::depth = MAX_DEPTH;
+                                          memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                          iterator_base::key_bytes[sizeof(radix_type)] = 0xFF;
+                                          iterator_base::depth = MAX_DEPTH;
                                       }
                                   }
                               }
-                                  const_reverse_iterator(union ptr_s *root):
-                                      const_iterator_base(root)
+                                  const_reverse_iterator(const arraymap *owner):
+                                      iterator_base(owner)
                               {
-                                  memset(const_iterator_base::key_bytes, 0, sizeof(key_type));
-                                  const_iterator_base::key_bytes[sizeof(key_type)] = 0xFF;
-                                  const_iterator_base::depth = MAX_DEPTH;
+                                  memset(iterator_base::key_bytes, 0, sizeof(radix_type));
+                                  iterator_base::key_bytes[sizeof(radix_type)] = 0xFF;
+                                  iterator_base::depth = MAX_DEPTH;
                               }
                               public:
                                   const_reverse_iterator operator--(int)
@@ -676,7 +1238,7 @@ namespace arraymap{
                                   }
                                   const_reverse_iterator& operator--()
                                   {
-                                      const_iterator_base::increment();
+                                      iterator_base::increment();
                                       return *this;
                                   }
                                   const_reverse_iterator operator++(int)
@@ -687,53 +1249,275 @@ namespace arraymap{
                                   }
                                   const_reverse_iterator& operator++()
                                   {
-                                      const_iterator_base::decrement();
+                                      iterator_base::decrement();
                                       return *this;
                                   }
                           };
-
-                          mapped_type& operator[](const key_type& __k)
-                          {
-                              union ptr_s result = element_fast_find(Ordering::apply( __k ));
-
-                              if(result == *empty_node)
+                          /*
+                           * Lookup cursor for streams of nearby keys. It keeps the slots the last lookup went through and
+                           * starts the next one at the deepest of them still on the new key's path, found from the
+                           * highest tetrade the two keys differ in, instead of at the root. It follows changes made to
+                           * the map through any means, starting over at the root once one of them has moved nodes.
+                           */
+                          class finger{
+                              public:
+                                  finger(arraymap &owner) noexcept:
+                                      map(&owner),
+                                      version(owner.version),
+                                      depth(0)
                               {
-                                  result = element_fast_add(Ordering::apply( __k ));
-                                  element_count++;
                               }
-
+                                  mapped_type *find(const key_type &key)
+                                  {
+                                      return descend(Ordering::apply(key));
+                                  }
+                                  bool contains(const key_type &key)
+                                  {
+                                      return find(key) != nullptr;
+                                  }
+                                  /*
+                                   * A lookup never checks the prefixes of the nodes it passes, so a missing key is added
+                                   * below the deepest node of its path whose prefix it does match.
+                                   */
+                                  mapped_type &operator[](const key_type &key)
+                                  {
+                                      mapped_type *value = descend(Ordering::apply(key));
+                                      if(value == nullptr)
+                                      {
+                                          const unsigned char *key_bytes = (const unsigned char*)&last;
+                                          unsigned short i = depth - 1;
+                                          for(; i > 0 && prefix_mismatch(key_bytes, path[i]->next) >= 0; i--);
+                                          value = map->element_fast_slot(key_bytes, path[i]);
+                                          std::construct_at(value);
+                                          map->element_count++;
+                                      }
+                                      return *value;
+                                  }
+                              private:
+                                  arraymap *map;
+                                  std::size_t version;
+                                  radix_type last;
+                                  unsigned short depth;
+                                  union ptr_s *path[MAX_DEPTH + 1];
+
+                                  /*
+                                   * Every node above the level the keys differ at was reached by tetrades they share,
+                                   * the leaf prefix check at the end covers whatever the skipped part does not.
+                                   */
+                                  mapped_type *descend(const radix_type &key)
+                                  {
+                                      const unsigned char *key_bytes = (const unsigned char*)&key;
+                                      unsigned short i = 0;
+                                      if(version == map->version && depth != 0)
+                                      {
+                                          unsigned short level = split_level(key, last);
+                                          for(i = depth - 1; i > 0 && path[i]->next->level < level; i--);
+                                      }
+                                      else
+                                          path[0] = &map->root;
+                                      version = map->version;
+                                      last = key;
+
+                                      union ptr_s *slot = path[i];
+                                      while(slot->next->level != 0)
+                                      {
+                                          map->hooks.hop(slot->next->level);
+                                          union ptr_s *child = node_child(slot->next, tetradeValue(key_bytes, slot->next->level));
+                                          if(is_empty(*child))
+                                              break;
+                                          path[++i] = slot = child;
+                                      }
+                                      depth = i + 1;
+
+                                      mapped_type *value = slot->next->level == 0 ? leaf_find(key_bytes, slot->next) : nullptr;
+                                      if(value == nullptr)
+                                          map->hooks.miss(slot->next->level);
+                                      return value;
+                                  }
+                          };
+                          /*
+                           * Forward cursor that holds no more than the map, the leaf it is on and the applied key, where
+                           * an iterator also carries a slot per level and a copy of the current element. Stepping moves
+                           * along the leaf and, once it runs out, descends from the root straight to the next one.
+                           * After a change to the map it looks its key up again. If its own element was erased it is then
+                           * on the next one, which key() and value() report and ++ steps over, or false past the last.
+                           * value() throws std::out_of_range once past the last element.
+                           */
+                          template<bool Const>
+                              class basic_cursor{
+                                  friend class arraymap;
+                                  typedef typename std::conditional<Const, const arraymap, arraymap>::type owner_type;
+                                  typedef typename std::conditional<Const, const mapped_type, mapped_type>::type value_type;
+                                  public:
+                                      basic_cursor() noexcept:
+                                          map(nullptr),
+                                          leaf(nullptr),
+                                          version(0),
+                                          position{}
+                                  {
+                                  }
+                                      explicit operator bool() const noexcept
+                                      {
+                                          refresh();
+                                          return leaf != nullptr;
+                                      }
+                                      key_type key() const
+                                      {
+                                          refresh();
+                                          return Ordering::restore(position);
+                                      }
+                                      value_type &value() const
+                                      {
+                                          refresh();
+                                          if(leaf == nullptr)
+                                              throw std::out_of_range("arraymap::cursor::value");
+                                          return *leaf_value(leaf, tetradeValue(bytes(), 0));
+                                      }
+                                      basic_cursor &operator++()
+                                      {
+                                          if(leaf == nullptr)
+                                              return *this;
+                                          if(version == map->version)
+                                          {
+                                              int tetrade = node_next_tetrade(leaf, tetradeValue(bytes(), 0) + 1);
+                                              if(tetrade < (int)FANOUT)
+                                              {
+                                                  setTetrade(bytes(), 0, tetrade);
+                                                  return *this;
+                                              }
+                                              setTetrade(bytes(), 0, FANOUT - 1);
+                                          }
+                                          if(key_increment(position))
+                                              seek();
+                                          else
+                                              leaf = nullptr;
+                                          return *this;
+                                      }
+                                      bool operator==(const basic_cursor &other) const noexcept
+                                      {
+                                          refresh();
+                                          other.refresh();
+                                          if(leaf == nullptr || other.leaf == nullptr)
+                                              return leaf == other.leaf;
+                                          return std::memcmp(&position, &other.position, sizeof(radix_type)) == 0;
+                                      }
+                                  private:
+                                      owner_type *map;
+                                      mutable const node_s *leaf;
+                                      mutable std::size_t version;
+                                      mutable radix_type position;
+
+                                      basic_cursor(owner_type *owner, const radix_type &key):
+                                          map(owner),
+                                          position(key)
+                                  {
+                                      seek();
+                                  }
+                                      unsigned char *bytes() const
+                                      {
+                                          return (unsigned char*)&position;
+                                      }
+                                      /*
+                                       * Finds the leaf again after a change, position moves on if its element is gone.
+                                       */
+                                      void refresh() const noexcept
+                                      {
+                                          if(leaf != nullptr && version != map->version)
+                                              seek();
+                                      }
+                                      /*
+                                       * Moves to the first element at or after position.
+                                       */
+                                      void seek() const
+                                      {
+                                          int tetrade;
+                                          version = map->version;
+                                          leaf = map->leaf_lower_bound(bytes(), tetrade);
+                                          if(leaf == nullptr)
+                                              return;
+                                          std::memcpy(bytes(), leaf->prefix, sizeof(radix_type));
+                                          setTetrade(bytes(), 0, tetrade);
+                                      }
+                              };
+                          typedef basic_cursor<false> cursor;
+                          typedef basic_cursor<true> const_cursor;
+
+                          mapped_type& operator[](const key_type& __k)
+                          {
+                              union ptr_s result = element_fast_find(Ordering::apply( __k ));
+
+                              if(is_empty(result))
+                              {
+                                  result = element_fast_add(Ordering::apply( __k ));
+                                  element_count++;
+                              }
+
                               return *result.val;
                           }
                           mapped_type& at(const key_type& __k) const
                           {
                               union ptr_s result = element_fast_find(Ordering::apply( __k ));
 
-                              if(result == *empty_node)
+                              if(is_empty(result))
                                   throw std::out_of_range("arraymap::at");
 
-                              return *result->val;
+                              return *result.val;
                           }
                           bool empty() const noexcept
                           {
                               return element_count == 0;
                           }
+                          allocator_type get_allocator() const noexcept
+                          {
+                              return alloc;
+                          }
                           void clear() noexcept
                           {
-                              free_node_tree(&root, MAX_DEPTH);
-                              root.next = empty_node;
+                              stats_tree([&](unsigned int kind, std::size_t count){ hooks.node_freed(kind, count); });
+                              free_values(&root);
+                              pool.release();
+                              root.next = &empty_node;
                               element_count = 0;
+                              version++;
+                          }
+                          /*
+                           * Moves every node into freshly taken chunks, depth first and back to back, so each subtree
+                           * lies in one stretch of memory and lookups and iteration touch as few pages as possible.
+                           * The old chunks, with all the holes left by erasing, go back to the allocator. Values outside
+                           * of inline leaves stay where they are. Needs room for a second copy of the nodes while it
+                           * runs, leaves the map as it was if that cannot be had, and invalidates all iterators.
+                           */
+                          void compact()
+                          {
+                              if(empty())
+                              {
+                                  pool.release();
+                                  return;
+                              }
+
+                              pool_type fresh(alloc);
+                              union ptr_s moved = root;
+                              node_relocate(fresh, &moved);
+                              stats_tree([&](unsigned int kind, std::size_t count){ hooks.node_freed(kind, count); hooks.node_allocated(kind, count); });
+                              root = moved;
+                              pool.swap(fresh);
+                              version++;
+                          }
+                          void shrink_to_fit()
+                          {
+                              compact();
                           }
                           iterator begin() noexcept
                           {
-                              unsigned char bytes[sizeof(key_type)];
-                              memset(bytes, 0, sizeof(key_type));
-                              return iterator(&this->root, *( (key_type*) bytes), true);
+                              iterator it(this);
+                              it.seek_first();
+                              return it;
                           }
                           const_iterator cbegin() const noexcept
                           {
-                              unsigned char bytes[sizeof(key_type)];
-                              memset(bytes, 0, sizeof(key_type));
-                              return const_iterator(&this->root, *( (key_type*) bytes), true);
+                              const_iterator it(this);
+                              it.seek_first();
+                              return it;
                           }
                           const iterator &end() const noexcept
                           {
@@ -745,9 +1529,9 @@ namespace arraymap{
                           }
                           reverse_iterator rbegin() noexcept
                           {
-                              unsigned char bytes[sizeof(key_type)];
-                              memset(bytes, 0xFF, sizeof(key_type));
-                              return reverse_iterator(&this->root, *( (key_type*) bytes), true);
+                              reverse_iterator it(this);
+                              it.seek_last();
+                              return it;
                           }
                           reverse_iterator rend() noexcept
                           {
@@ -755,33 +1539,64 @@ namespace arraymap{
                           }
                           const_reverse_iterator crbegin() noexcept
                           {
-                              unsigned char bytes[sizeof(key_type)];
-                              memset(bytes, 0xFF, sizeof(key_type));
-                              return const_reverse_iterator(&this->root, *( (key_type*) bytes), true);
+                              const_reverse_iterator it(this);
+                              it.seek_last();
+                              return it;
                           }
                           const const_reverse_iterator &crend() noexcept
                           {
                               return crend_it;
                           }
+                          /*
+                           * Cursors on the first element, on key (false when it is missing) and on the first element
+                           * not less than key.
+                           */
+                          cursor cursor_begin()
+                          {
+                              return cursor(this, radix_type{});
+                          }
+                          const_cursor cursor_begin() const
+                          {
+                              return const_cursor(this, radix_type{});
+                          }
+                          cursor cursor_find(const key_type &key)
+                          {
+                              return exact_cursor(cursor(this, Ordering::apply(key)), Ordering::apply(key));
+                          }
+                          const_cursor cursor_find(const key_type &key) const
+                          {
+                              return exact_cursor(const_cursor(this, Ordering::apply(key)), Ordering::apply(key));
+                          }
+                          cursor cursor_lower_bound(const key_type &key)
+                          {
+                              return cursor(this, Ordering::apply(key));
+                          }
+                          const_cursor cursor_lower_bound(const key_type &key) const
+                          {
+                              return const_cursor(this, Ordering::apply(key));
+                          }
                           iterator find(const key_type &key)
                           {
-                              return iterator(&root, Ordering::apply(key), false);
+                              return iterator(this, Ordering::apply(key), false);
+                          }
+                          const_iterator find(const key_type &key) const
+                          {
+                              return const_iterator(this, Ordering::apply(key), false);
                           }
                           iterator lower_bound(const key_type &key)
                           {
-                              return iterator(&root, Ordering::apply(key), true);
+                              return iterator(this, Ordering::apply(key), true);
                           }
                           iterator upper_bound(const key_type &key)
                           {
-                              iterator it(&root, Ordering::apply(key), false);
-                              if(it == end_it)
-                                  return iterator(&root, Ordering::apply(key), true);
-                              else
-                                  return ++it;
+                              iterator it(this);
+                              it.seek(Ordering::apply(key));
+                              it.step_forward(it.depth);
+                              return it;
                           }
                           size_type erase(const key_type& key)
                           {
-                              iterator it(&root, Ordering::apply(key), false);
+                              iterator it(this, Ordering::apply(key), false);
                               if(it != end_it)
                               {
                                   it.erase_elem();
@@ -799,245 +1614,3705 @@ namespace arraymap{
                           }
                           void erase(iterator first, iterator last)
                           {
-                              for(;first != last; first++) 
+                              if(first == last || first.key_bytes[sizeof(radix_type)] != 0)
+                                  return;
+
+                              radix_type lo, hi;
+                              std::memcpy(&lo, first.key_bytes, sizeof(radix_type));
+                              if(last.key_bytes[sizeof(radix_type)] != 0)
+                                  std::memset((void*)&hi, 0xFF, sizeof(radix_type));
+                              else
                               {
-                                  first.erase_elem();
-                                  element_count--;
+                                  std::memcpy(&hi, last.key_bytes, sizeof(radix_type));
+                                  key_decrement(hi);
                               }
+                              range_erase(lo, hi);
                           }
-                          size_type size()
+                          /*
+                           * Erases every key from lo up to but not including hi and returns how many there were.
+                           * Subtrees lying wholly inside the range are freed in one sweep without stepping through
+                           * their elements, only the nodes on the paths to lo and hi are trimmed child by child.
+                           */
+                          size_type erase_range(const key_type &lo, const key_type &hi)
                           {
-                              return element_count;
+                              radix_type first = Ordering::apply(lo), last = Ordering::apply(hi);
+                              if(!key_less(first, last))
+                                  return 0;
+                              key_decrement(last);
+                              return range_erase(first, last);
                           }
-                          std::pair<iterator,bool> insert(value_type &&value)
+                          /*
+                           * Order statistics, for maps with Counted set. rank(key) is the number of keys less than key,
+                           * count_range(lo, hi) the number from lo up to but not including hi, select(k) the k-th
+                           * smallest key (from 0) and nth_iterator(k) an iterator to it (end() past the last).
+                           * Each takes a single descent adding up the counts of the children left of the path.
+                           */
+                          size_type rank(const key_type &key) const
                           {
-                              bool added = false;
-                              union ptr_s result = element_fast_find(Ordering::apply(value.first));
-
-                              if(result == *empty_node)
+                              static_assert(COUNTED, "rank() needs an arraymap with Counted set!");
+                              return key_rank(Ordering::apply(key));
+                          }
+                          size_type count_range(const key_type &lo, const key_type &hi) const
+                          {
+                              size_type first = rank(lo), last = rank(hi);
+                              return last > first ? last - first : 0;
+                          }
+                          key_type select(size_type k) const
+                          {
+                              static_assert(COUNTED, "select() needs an arraymap with Counted set!");
+                              if(k >= element_count)
+                                  throw std::out_of_range("arraymap::select");
+                              return Ordering::restore(key_select(k));
+                          }
+                          iterator nth_iterator(size_type k)
+                          {
+                              static_assert(COUNTED, "nth_iterator() needs an arraymap with Counted set!");
+                              return k < element_count ? iterator(this, key_select(k), false) : end();
+                          }
+                          const_iterator nth_iterator(size_type k) const
+                          {
+                              static_assert(COUNTED, "nth_iterator() needs an arraymap with Counted set!");
+                              return k < element_count ? const_iterator(this, key_select(k), false) : cend();
+                          }
+                          /*
+                           * Moves every element of other into this map and leaves other empty, keys already present
+                           * keep their value here. Both trees are walked side by side and wherever other has a subtree
+                           * this map lacks it is hung in as it is, only the nodes both trees have are merged one by one.
+                           */
+                          void merge(arraymap &&other)
+                          {
+                              if(&other == this || other.empty())
+                                  return;
+                              if constexpr(!alloc_traits::is_always_equal::value)
+                                  if(alloc != other.alloc)
+                                  {
+                                      move_elements(other);
+                                      return;
+                                  }
+                              other.stats_tree([&](unsigned int kind, std::size_t count){ other.hooks.node_freed(kind, count); hooks.node_allocated(kind, count); });
+                              if(empty())
                               {
-                                  result = element_fast_add(Ordering::apply(value.first), std::move( value.second ));
-                                  element_count++;
-                                  added = true;
+                                  *this = std::move(other);
+                                  return;
                               }
-                              return std::make_pair(iterator(&root, Ordering::apply(value.first),false), added);
+
+                              pool.splice(other.pool);
+                              node_s *incoming = other.root.next;
+                              size_type added = other.element_count;
+                              other.root.next = &empty_node;
+                              other.element_count = 0;
+                              other.version++;
+
+                              element_count += added - merge_into(&root, incoming, true);
+                              version++;
+                          }
+                          size_type size() const
+                          {
+                              return element_count;
+                          }
+                          std::pair<iterator,bool> insert(value_type &&value)
+                          {
+                              return element_emplace(Ordering::apply(value.first), std::move(value.second));
                           }
                           std::pair<iterator,bool> insert(const value_type &value)
                           {
-                              bool added = false;
-                              union ptr_s result = element_fast_find(Ordering::apply(value.first));
-
-                              if(result == *empty_node)
-                              {
-                                  result = element_fast_add(Ordering::apply(value.first),  value.second );
-                                  element_count++;
-                                  added = true;
-                              }
-                              return std::make_pair(iterator(&root, Ordering::apply(value.first),false), added);
+                              return element_emplace(Ordering::apply(value.first), value.second);
+                          }
+                          iterator insert(const iterator_base &hint, value_type &&value)
+                          {
+                              return element_emplace_hint(hint, Ordering::apply(value.first), std::move(value.second));
+                          }
+                          iterator insert(const iterator_base &hint, const value_type &value)
+                          {
+                              return element_emplace_hint(hint, Ordering::apply(value.first), value.second);
                           }
                           void insert(std::initializer_list<value_type> ilist)
                           {
-                              for(value_type val : ilist)
-                                  insert(val);
+                              bulk_load(ilist.begin(), ilist.end());
                           }
                           void insert(const arraymap &other)
                           {
-                              for(auto it = other.cbegin(); it != other.cend(); it++)
-                                  insert(*it);
+                              if(empty())
+                                  clone_from(other, 1);
+                              else
+                                  bulk_load(other.cbegin(), other.cend());
                           }
+                          template<class InputIt>
+                              requires requires(InputIt it){ ++it; (*it).first; (*it).second; }
+                              void insert(InputIt first, InputIt last)
+                              {
+                                  bulk_load(first, last);
+                              }
+                          /*
+                           * Adds the key/value pairs of a range, keeping the first of equal keys like insert() does.
+                           * An empty map is built bottom-up, every node once at its final size, which is fastest when
+                           * the range is already sorted (it gets sorted otherwise). A map that has elements already
+                           * gets them inserted one by one.
+                           */
+                          template<class InputIt>
+                              void bulk_load(InputIt first, InputIt last)
+                              {
+                                  if(!empty())
+                                  {
+                                      for(; first != last; ++first)
+                                          insert(*first);
+                                      return;
+                                  }
+
+                                  std::vector<radix_type> keys;
+                                  std::vector<mapped_type> values;
+                                  for(; first != last; ++first)
+                                  {
+                                      auto &&item = *first;
+                                      keys.push_back(Ordering::apply(item.first));
+                                      values.emplace_back(item.second);
+                                  }
+
+                                  if(!std::is_sorted(keys.begin(), keys.end(), key_less))
+                                  {
+                                      std::vector<std::size_t> order(keys.size());
+                                      for(std::size_t i = 0; i < order.size(); i++)
+                                          order[i] = i;
+                                      std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){ return key_less(keys[a], keys[b]); });
+
+                                      std::vector<radix_type> sorted_keys;
+                                      std::vector<mapped_type> sorted_values;
+                                      sorted_keys.reserve(keys.size());
+                                      sorted_values.reserve(values.size());
+                                      for(std::size_t i : order)
+                                      {
+                                          sorted_keys.push_back(keys[i]);
+                                          sorted_values.push_back(std::move(values[i]));
+                                      }
+                                      keys.swap(sorted_keys);
+                                      values.swap(sorted_values);
+                                  }
+
+                                  std::size_t count = 0;
+                                  for(std::size_t i = 0; i < keys.size(); i++)
+                                  {
+                                      if(count > 0 && !key_less(keys[count - 1], keys[i]))
+                                          continue;
+                                      if(count != i)
+                                      {
+                                          keys[count] = keys[i];
+                                          values[count] = std::move(values[i]);
+                                      }
+                                      count++;
+                                  }
+                                  if(count == 0)
+                                      return;
+
+                                  root.next = bulk_node(keys.data(), values.data(), count, split_level(keys[0], keys[count - 1]));
+                                  element_count = count;
+                                  version++;
+                              }
                           template< class... Args >
                               std::pair<iterator,bool> emplace( Args&&... args )
                               {
                                   return insert(value_type(std::forward<Args>(args)...));
                               }
+                          template< class... Args >
+                              iterator emplace_hint(const iterator_base &hint, Args&&... args)
+                              {
+                                  return insert(hint, value_type(std::forward<Args>(args)...));
+                              }
                           template < class... Args >
-                              std::pair<iterator,bool> try_emplace(key_type &&k, Args&&... args)
+                              std::pair<iterator,bool> try_emplace(const key_type &k, Args&&... args)
                               {     
-                                  bool added = false;
-                                  union ptr_s result = element_fast_find(Ordering::apply(k));
-
-                                  if(result == *empty_node)
-                                  {
-                                      result = element_fast_add(Ordering::apply(k), std::forward<Args>(args)...);
-                                      element_count++;
-                                      added = true;
-                                  }
-                                  return std::make_pair(iterator(&root, Ordering::apply(k),false), added);
+                                  return element_emplace(Ordering::apply(k), std::forward<Args>(args)...);
+                              }
+                          template < class... Args >
+                              iterator try_emplace(const iterator_base &hint, const key_type &k, Args&&... args)
+                              {     
+                                  return element_emplace_hint(hint, Ordering::apply(k), std::forward<Args>(args)...);
                               }
-                          bool contains(const key_type& __k)
+                          bool contains(const key_type& __k) const
                           {
                               union ptr_s result = element_fast_find(Ordering::apply(__k));
-                              return result != *empty_node;
+                              return !is_empty(result);
                           }
-
-                      private:
-                          union ptr_s root;
-                          iterator end_it;
-                          const_iterator cend_it;
-                          reverse_iterator rend_it;
-                          const_reverse_iterator crend_it;
-                          size_type element_count;
-                          union ptr_s node_add_empty_node(void)
+                          /*
+                           * Batched lookups, the output spans must be at least as long as keys. find_many stores nullptr
+                           * for missing keys and contains_many returns how many were found. at_many throws
+                           * std::out_of_range on the first missing key it meets, the keys are not looked up in order and
+                           * by then any of the others may already have had their values written.
+                           */
+                          void find_many(std::span<const key_type> keys, std::span<mapped_type*> values)
                           {
-                              union ptr_s ret;
-                              ret.next = new union ptr_s[0x10];
-
-                              for(int i = 0; i < 0x10; i++)
-                                  ret.next[i].next = empty_node;
-
-                              return ret;
+                              element_find_many(keys, [&](std::size_t i, mapped_type *value){ values[i] = value; });
                           }
-                          static void free_node_tree(union ptr_s *ptr, unsigned int depth)
+                          void find_many(std::span<const key_type> keys, std::span<const mapped_type*> values) const
                           {
-                              if(*ptr == *empty_node) return;
-
-                              if(depth == 0) 
-                              {
-                                  std::destroy_at(ptr->val);
-                                  alloc.deallocate(ptr->val, 1);
-                                  return;
-                              }
-
-                              for(int i = 0; i < 0x10; i++)
-                                  free_node_tree(ptr->next + i, depth - 1);
-
-                              delete[] ptr->next;
+                              element_find_many(keys, [&](std::size_t i, const mapped_type *value){ values[i] = value; });
                           }
-                          static bool is_node_empty(union ptr_s node) 
+                          std::size_t contains_many(std::span<const key_type> keys, std::span<bool> found) const
                           {
-                              for(int i = 0; i < 0x10; i++)
-                                  if(node.next[i] != *empty_node) return false;
-                              return true;
+                              std::size_t count = 0;
+                              element_find_many(keys, [&](std::size_t i, mapped_type *value){ count += found[i] = value != nullptr; });
+                              return count;
                           }
-                          inline union ptr_s element_fast_find(const key_type key) const
+                          void at_many(std::span<const key_type> keys, std::span<mapped_type> values) const
                           {
-                              unsigned char *key_bytes = (unsigned char*)&key;
-                              const union ptr_s *current_Node = &root;
-                              unsigned int tetradeNr =  MAX_DEPTH - 1;
-                              do{
-                                  current_Node = ( current_Node->next + tetradeValue(key_bytes, tetradeNr));
-                              }while(tetradeNr-- > 0);
-                              return *current_Node;
+                              element_find_many(keys, [&](std::size_t i, mapped_type *value)
+                                      {
+                                          if(value == nullptr)
+                                              throw std::out_of_range("arraymap::at_many");
+                                          values[i] = *value;
+                                      });
                           }
-                          union ptr_s element_fast_add(const key_type key)
+                          /*
+                           * Cuts the map into up to n consecutive ranges along the children of the highest node that
+                           * branches, so every range covers whole subtrees and can be walked independently of the others.
+                           */
+                          std::vector<std::pair<const_iterator, const_iterator>> split(unsigned int n) const
                           {
-                              unsigned char *key_bytes = (unsigned char*)&key;
-                              union ptr_s *current_Node = &root;
-                              unsigned int tetradeNr =  MAX_DEPTH - 1;
-                              do{
-                                  if(*current_Node == *empty_node)
-                                      *current_Node = node_add_empty_node();
-                                  current_Node =( current_Node->next + tetradeValue(key_bytes, tetradeNr));
-                              }while(tetradeNr-- > 0);
+                              std::vector<std::pair<const_iterator, const_iterator>> ranges;
+                              if(empty())
+                                  return ranges;
+
+                              const node_s *node = root.next;
+                              while(node->level != 0 && node->count == 1)
+                                  node = node_child(node, node_next_tetrade(node, 0))->next;
+
+                              std::vector<int> tetrades;
+                              for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                                  tetrades.push_back(tetrade);
+                              std::size_t groups = std::clamp<std::size_t>(n, 1, tetrades.size());
+
+                              const_iterator from = cbegin();
+                              for(std::size_t i = 1; i < groups; i++)
+                              {
+                                  unsigned char bytes[sizeof(radix_type)];
+                                  std::memcpy(bytes, node->prefix, sizeof(radix_type));
+                                  for(unsigned int level = 0; level < node->level; level++)
+                                      setTetrade(bytes, level, 0);
+                                  setTetrade(bytes, node->level, tetrades[i * tetrades.size() / groups]);
+
+                                  radix_type key;
+                                  std::memcpy(&key, bytes, sizeof(radix_type));
+                                  const_iterator to(this, key, true);
+                                  ranges.emplace_back(from, to);
+                                  from = to;
+                              }
+                              ranges.emplace_back(from, cend());
+                              return ranges;
+                          }
+                          /*
+                           * Calls f(key, value) for every element in key order, or for those from lo up to but not
+                           * including hi, recursing over the nodes instead of stepping an iterator. A leaf's key is put
+                           * together once and only its last tetrade changes from element to element. f may change the
+                           * values but not the map.
+                           */
+                          template<class F>
+                              void for_each(F &&f)
+                              {
+                                  if(!is_empty(root))
+                                      visit_tree<mapped_type>(root.next, f);
+                              }
+                          template<class F>
+                              void for_each(F &&f) const
+                              {
+                                  if(!is_empty(root))
+                                      visit_tree<const mapped_type>(root.next, f);
+                              }
+                          template<class F>
+                              void for_each_range(const key_type &lo, const key_type &hi, F &&f)
+                              {
+                                  radix_type first = Ordering::apply(lo), last = Ordering::apply(hi);
+                                  if(is_empty(root) || !key_less(first, last))
+                                      return;
+                                  key_decrement(last);
+                                  visit_range<mapped_type>(root.next, first, last, f);
+                              }
+                          template<class F>
+                              void for_each_range(const key_type &lo, const key_type &hi, F &&f) const
+                              {
+                                  radix_type first = Ordering::apply(lo), last = Ordering::apply(hi);
+                                  if(is_empty(root) || !key_less(first, last))
+                                      return;
+                                  key_decrement(last);
+                                  visit_range<const mapped_type>(root.next, first, last, f);
+                              }
+                          /*
+                           * Calls f(key, value) for every element from up to threads threads, each taking ranges from
+                           * split() until none are left. f may change the values but not the map.
+                           */
+                          template<class F>
+                              void parallel_for_each(F f, unsigned int threads = std::thread::hardware_concurrency())
+                              {
+                                  auto ranges = split(std::max(threads, 1u) * 4);
+                                  run_parallel(threads, ranges.size(), [&](std::size_t i)
+                                          {
+                                              for(const_iterator it = ranges[i].first; it != ranges[i].second; ++it)
+                                                  f(it->first, it->second.get());
+                                          });
+                              }
+                          /*
+                           * Folds transform(key, value) of every element with combine, each range of split() on its own
+                           * first and the partial results in key order after that, starting from init.
+                           */
+                          template<class T, class Transform, class Combine>
+                              T parallel_reduce(T init, Transform transform, Combine combine, unsigned int threads = std::thread::hardware_concurrency()) const
+                              {
+                                  auto ranges = split(std::max(threads, 1u) * 4);
+                                  std::vector<std::optional<T>> partial(ranges.size());
+                                  run_parallel(threads, ranges.size(), [&](std::size_t i)
+                                          {
+                                              for(const_iterator it = ranges[i].first; it != ranges[i].second; ++it)
+                                              {
+                                                  if(partial[i])
+                                                      partial[i] = combine(std::move(*partial[i]), transform(it->first, it->second.get()));
+                                                  else
+                                                      partial[i] = transform(it->first, it->second.get());
+                                              }
+                                          });
 
-                              current_Node->val = alloc.allocate(1);
-                              std::construct_at(current_Node->val);
-                              return *current_Node;
+                                  for(std::optional<T> &result : partial)
+                                      if(result)
+                                          init = combine(std::move(init), std::move(*result));
+                                  return init;
+                              }
+                          /*
+                           * Replaces the contents with a copy of other, the top of the tree is copied here and the
+                           * subtrees below it by up to threads threads into pools of their own, which are merged into ours.
+                           */
+                          void assign(const arraymap &other, unsigned int threads)
+                          {
+                              if(&other == this)
+                                  return;
+                              clear();
+                              if constexpr(alloc_traits::propagate_on_container_copy_assignment::value)
+                              {
+                                  alloc = other.alloc;
+                                  pool.reset(alloc);
+                              }
+                              clone_from(other, threads);
                           }
-                          union ptr_s element_fast_add(const key_type key, mapped_type value)
+                          /*
+                           * Writes the tree to path as an image for mapped_arraymap: the nodes as they are, children before
+                           * their parents and with offsets into the file in place of pointers, values outside of inline
+                           * leaves packed next to their leaf. The header records the key, value and node sizes, the radix
+                           * and a fingerprint of the ordering, the image is only good for the same map type and machine.
+                           */
+                          void save(const std::string &path) const
                           {
-                              unsigned char *key_bytes = (unsigned char*)&key;
-                              union ptr_s *current_Node = &root;
-                              unsigned int tetradeNr =  MAX_DEPTH - 1;
-                              do{
-                                  if(*current_Node == *empty_node)
-                                      *current_Node = node_add_empty_node();
-                                  current_Node =( current_Node->next + tetradeValue(key_bytes, tetradeNr));
-                              }while(tetradeNr-- > 0);
-
-                              current_Node->val = alloc.allocate(1);
-                              std::construct_at(current_Node->val, std::move(value));
-                              return *current_Node;
+                              static_assert(std::is_trivially_copyable<mapped_type>::value, "Arraymap images require mapped type to be trivially copyable!");
+                              static_assert(alignof(mapped_type) <= IMAGE_ALIGN, "Arraymap images support mapped types aligned to at most 64 bytes!");
+
+                              std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                              image_header_s header = image_header();
+                              out.write((const char*)&header, sizeof(header));
+
+                              image_writer_s writer{out, sizeof(header), {}};
+                              if(!is_empty(root))
+                                  header.root = save_node(writer, root.next);
+                              header.element_count = element_count;
+                              header.size = writer.offset;
+                              out.seekp(0);
+                              out.write((const char*)&header, sizeof(header));
+                              out.flush();
+                              if(!out)
+                                  throw std::runtime_error("arraymap::save: cannot write " + path);
                           }
-                          template< class... Args >
-                              union ptr_s element_fast_add(const key_type key,Args&&... args)
+                          /*
+                           * Streams the elements in key order, STREAM_CHUNK at a time: the number of elements, the
+                           * ordered keys as varints of their distance from the key before and then the values as they are.
+                           * A chunk of 0 elements ends the stream. sink(data, size) gets one chunk at a time.
+                           */
+                          template<class Sink>
+                              requires std::is_invocable_v<Sink&, const unsigned char*, std::size_t>
+                              void serialize(Sink &&sink) const
                               {
-                                  unsigned char *key_bytes = (unsigned char*)&key;
-                                  union ptr_s *current_Node = &root;
-                                  unsigned int tetradeNr =  MAX_DEPTH - 1;
-                                  do{
-                                      if(*current_Node == *empty_node)
-                                          *current_Node = node_add_empty_node();
-                                      current_Node =( current_Node->next + tetradeValue(key_bytes, tetradeNr));
-                                  }while(tetradeNr-- > 0);
+                                  static_assert(std::is_trivially_copyable<mapped_type>::value, "Arraymap streams require mapped type to be trivially copyable!");
+                                  stream_header_s header = stream_header();
+                                  sink((const unsigned char*)&header, sizeof(header));
 
-                                  current_Node->val = alloc.allocate(1);
-                                  std::construct_at(current_Node->val, std::forward<Args>(args)...);
-                                  return *current_Node;
+                                  std::vector<unsigned char> chunk;
+                                  std::vector<const mapped_type*> values;
+                                  key_number previous{};
+                                  const_iterator it = cbegin();
+                                  for(size_type left = element_count; left > 0; left -= values.size())
+                                  {
+                                      chunk.clear();
+                                      values.clear();
+                                      put_varint(chunk, key_number{std::min<size_type>(left, STREAM_CHUNK)});
+                                      for(; it != cend_it && values.size() < STREAM_CHUNK; ++it)
+                                      {
+                                          key_number key = to_number(it.key_bytes);
+                                          put_varint(chunk, subtract(key, previous));
+                                          previous = key;
+                                          values.push_back(&it.currentValue.second.get());
+                                      }
+                                      for(const mapped_type *value : values)
+                                          chunk.insert(chunk.end(), (const unsigned char*)value, (const unsigned char*)(value + 1));
+                                      sink(chunk.data(), chunk.size());
+                                  }
+                                  unsigned char end = 0;
+                                  sink(&end, 1);
                               }
-                          static inline unsigned char tetradeValue(const unsigned char *bytes, unsigned int Nr)
+                          void serialize(std::ostream &out) const
                           {
-                              static const unsigned char bitShift[2] = { 0, 4 };
-                              return ( bytes[Nr >> 1] >> bitShift[Nr & 1] ) & 0xF;
+                              serialize([&](const unsigned char *data, std::size_t size){ out.write((const char*)data, size); });
+                              if(!out)
+                                  throw std::runtime_error("arraymap::serialize: cannot write");
                           }
+                          /*
+                           * Reads a stream written by serialize, source(data, size) filling data with up to size bytes
+                           * and returning how many it gave, 0 at the end. Each chunk of (already sorted) elements is built
+                           * bottom-up and merged into the tree, which only touches the path its keys share with those
+                           * before it, so no more than a chunk is ever buffered. Keys already in the map keep their values.
+                           */
+                          template<class Source>
+                              requires std::is_invocable_r_v<std::size_t, Source&, unsigned char*, std::size_t>
+                              void deserialize(Source &&source)
+                              {
+                                  static_assert(std::is_trivially_copyable<mapped_type>::value, "Arraymap streams require mapped type to be trivially copyable!");
+                                  stream_reader_s<Source> reader{source, std::vector<unsigned char>(1 << 16), 0, 0};
+                                  stream_header_s header, expected = stream_header();
+                                  reader.read(&header, sizeof(header));
+                                  if(std::memcmp(&header, &expected, sizeof(header)) != 0)
+                                      throw std::runtime_error("arraymap::deserialize: not a stream of this map type");
 
-                      public:
-                          arraymap(void):
-                              end_it(&this->root),
-                              cend_it(&this->root),
-                              rend_it(&this->root),
-                              crend_it(&this->root),
-                              element_count(0)
-                      {
-                          for(int i = 0; i < 0x10; i++)
-                              empty_node[i].next = empty_node; //TODO figure out a way to get rid of this initialization in constructor and initialize empty_node only once
+                                  std::vector<radix_type> keys;
+                                  std::vector<mapped_type> values;
+                                  key_number previous{};
+                                  bool first = true;
+                                  for(;;)
+                                  {
+                                      key_number count = reader.varint();
+                                      if(count == key_number{})
+                                          break;
+                                      if(count != key_number{count[0]} || count[0] > STREAM_CHUNK)
+                                          throw std::runtime_error("arraymap::deserialize: corrupt stream");
 
-                          root.next = empty_node;
-                      }
-                          arraymap(std::initializer_list<value_type> ilist):
-                              arraymap()
-                      {
-                          insert(ilist);
-                      }
-                          arraymap(const arraymap &other):
-                              arraymap()
-                      {
-                          for(auto it = other.cbegin(); it != other.cend(); it++)
+                                      keys.resize(count[0]);
+                                      for(radix_type &key : keys)
+                                      {
+                                          key_number delta = reader.varint();
+                                          if((!first && delta == key_number{}) || !add(previous, delta))
+                                              throw std::runtime_error("arraymap::deserialize: corrupt stream");
+                                          key = from_number(previous);
+                                          first = false;
+                                      }
+                                      values.clear();
+                                      for(std::size_t i = 0; i < keys.size(); i++)
+                                      {
+                                          alignas(mapped_type) unsigned char value[sizeof(mapped_type)];
+                                          reader.read(value, sizeof(mapped_type));
+                                          values.push_back(*std::launder((mapped_type*)value));
+                                      }
+
+                                      node_s *incoming = bulk_node(keys.data(), values.data(), keys.size(), split_level(keys.front(), keys.back()));
+                                      size_type duplicates = 0;
+                                      if(is_empty(root))
+                                          root.next = incoming;
+                                      else
+                                          duplicates = merge_into(&root, incoming, true);
+                                      element_count += keys.size() - duplicates;
+                                      version++;
+                                  }
+                              }
+                          void deserialize(std::istream &in)
                           {
-                              insert(*it);
+                              deserialize([&](unsigned char *data, std::size_t size) -> std::size_t
+                                      {
+                                          in.read((char*)data, size);
+                                          return in.gcount();
+                                      });
                           }
-                      }
-                          arraymap(arraymap &&other):
-                              end_it(other.end_it),
-                              cend_it(other.cend_it),
-                              rend_it(other.rend_it),
-                              crend_it(other.rend_it),
-                              element_count(other.element_count)
-                      {
-                          root = other.root;
-                          element_count = other.element_count;
-                          other.root = empty_node;
-                          other.element_count = 0;
-                      }
-                          arraymap &operator=(const arraymap& other)
+                          /*
+                           * Shape and memory use of a tree. Depths count nodes from the root down (compressed paths can
+                           * skip levels in between), slots are the occupied children or values of the nodes and capacity
+                           * how many they have room for. Value bytes are those of values allocated outside of the nodes,
+                           * without allocator overhead.
+                           */
+                          struct memory_stats_type{
+                              size_type elements;
+                              size_type nodes;
+                              std::array<size_type, MAX_DEPTH> nodes_per_depth;
+                              std::array<std::size_t, MAX_DEPTH> node_bytes_per_depth;
+                              std::array<size_type, 4> nodes_per_kind;
+                              size_type slots;
+                              size_type capacity;
+                              double slots_per_node;
+                              double fill_factor;
+                              std::size_t node_bytes;
+                              std::size_t pool_bytes;
+                              std::size_t value_bytes;
+                              double bytes_per_element;
+                          };
+                          memory_stats_type memory_stats() const
                           {
-                              clear();
-                              for(auto it = other.cbegin(); it != other.cend(); it++)
+                              memory_stats_type stats{};
+                              if(!is_empty(root))
+                                  stats_node(stats, root.next, 0);
+                              stats.pool_bytes = pool.reserved();
+                              return stats_finish(stats, element_count);
+                          }
+                          /*
+                           * Predicts memory_stats() of a map holding the keys of sample without building it, the tree has
+                           * exactly the shape it would get. With total larger than the number of distinct keys in the
+                           * sample everything is scaled up in proportion, which assumes the keys spread like the sample
+                           * does and overestimates when the sample is a thinned out dense range.
+                           */
+                          static memory_stats_type estimate_memory(std::span<const key_type> sample, size_type total = 0)
+                          {
+                              std::vector<radix_type> keys;
+                              keys.reserve(sample.size());
+                              for(const key_type &key : sample)
+                                  keys.push_back(Ordering::apply(key));
+                              std::sort(keys.begin(), keys.end(), key_less);
+                              keys.erase(std::unique(keys.begin(), keys.end(), [](const radix_type &a, const radix_type &b){ return !key_less(a, b) && !key_less(b, a); }), keys.end());
+
+                              memory_stats_type stats{};
+                              if(keys.empty())
+                                  return stats;
+                              estimate_node(stats, keys.data(), keys.size(), split_level(keys.front(), keys.back()), 0);
+
+                              if(total > keys.size())
                               {
-                                  insert(*it);
+                                  double scale = (double)total / keys.size();
+                                  auto scaled = [&](auto &count){ count = (std::remove_reference_t<decltype(count)>)(count * scale + 0.5); };
+                                  scaled(stats.nodes);
+                                  std::for_each(stats.nodes_per_depth.begin(), stats.nodes_per_depth.end(), scaled);
+                                  std::for_each(stats.node_bytes_per_depth.begin(), stats.node_bytes_per_depth.end(), scaled);
+                                  std::for_each(stats.nodes_per_kind.begin(), stats.nodes_per_kind.end(), scaled);
+                                  scaled(stats.slots);
+                                  scaled(stats.capacity);
+                                  scaled(stats.node_bytes);
                               }
-                              return *this;
+                              stats.pool_bytes = stats.node_bytes;
+                              return stats_finish(stats, std::max<size_type>(total, keys.size()));
                           }
-                          arraymap &operator=(arraymap&& other) noexcept
+                          /*
+                           * The stats policy with what it has counted so far, see stats_counters.
+                           */
+                          const stats_type &stats() const noexcept
                           {
-                              clear();
-                              root = other.root;
-                              element_count = other.element_count;
-                              other.root = empty_node;
-                              other.element_count = 0;
-                              return *this;
+                              return hooks;
                           }
-                          arraymap &operator=(std::initializer_list<value_type> ilist) noexcept
-                          {
-                              clear();
+
+                      private:
+                          typedef node_pool<Allocator, NODE_LEAF + 1> pool_type;
+
+                          [[no_unique_address]] Allocator alloc;
+                          pool_type pool;
+                          [[no_unique_address]] mutable Stats hooks;
+                          /*
+                           * Points at the highest node that branches, like any other compressed path, so keys sharing
+                           * their top tetrades start at the level they differ at. A key outside its prefix splits it
+                           * into a new node above, erasing down to a single child merges it away again.
+                           */
+                          union ptr_s root;
+                          std::size_t version;
+                          iterator end_it;
+                          const_iterator cend_it;
+                          reverse_iterator rend_it;
+                          const_reverse_iterator crend_it;
+                          size_type element_count;
+                          static bool is_empty(const union ptr_s &ptr)
+                          {
+                              return ptr.next == &empty_node;
+                          }
+                          node_s *node_new(node_kind kind, unsigned char level, const unsigned char *prefix)
+                          {
+                              node_s *node;
+                              if(kind == NODE_FULL)
+                              {
+                                  full_node_s *full = new(pool.allocate(NODE_FULL, sizeof(full_node_s))) full_node_s;
+                                  for(unsigned int i = 0; i < FANOUT; i++)
+                                      full->child[i].next = &empty_node;
+                                  full->mask.clear();
+                                  node = full;
+                              }
+                              else if(kind == NODE_MEDIUM)
+                                  node = new(pool.allocate(NODE_MEDIUM, sizeof(medium_node_s))) medium_node_s;
+                              else if(INLINE_VALUES && kind == NODE_LEAF)
+                              {
+                                  leaf_node_s *leaf = new(pool.allocate(NODE_LEAF, sizeof(leaf_node_s))) leaf_node_s;
+                                  leaf->mask.clear();
+                                  node = leaf;
+                              }
+                              else
+                                  node = new(pool.allocate(NODE_SMALL, sizeof(small_node_s))) small_node_s;
+
+                              node->kind = kind;
+                              node->level = level;
+                              node->count = 0;
+                              std::memcpy(node->prefix, prefix, sizeof(radix_type));
+                              hooks.node_allocated(kind, 1);
+                              return node;
+                          }
+                          void node_free(node_s *node)
+                          {
+                              hooks.node_freed(node->kind, 1);
+                              pool.deallocate(node, node->kind);
+                          }
+                          static std::size_t node_size(node_kind kind)
+                          {
+                              if(kind == NODE_FULL)
+                                  return sizeof(full_node_s);
+                              if(kind == NODE_MEDIUM)
+                                  return sizeof(medium_node_s);
+                              if(INLINE_VALUES && kind == NODE_LEAF)
+                                  return sizeof(leaf_node_s);
+                              return sizeof(small_node_s);
+                          }
+                          /*
+                           * Shallow copy of a single node, the children (and values, unless inline) are shared with the original.
+                           */
+                          node_s *node_copy(const node_s *node)
+                          {
+                              node_s *copy = (node_s*)pool.allocate(node->kind, node_size(node->kind));
+                              std::memcpy((void*)copy, node, node_size(node->kind));
+                              hooks.node_allocated(node->kind, 1);
+                              return copy;
+                          }
+                          /*
+                           * Copy of a single node taken from target and hung into slot, with its children (values outside
+                           * of inline leaves) left empty for the caller to fill, so a partial copy can always be freed.
+                           */
+                          static node_s *node_shell(pool_type &target, union ptr_s *slot, const node_s *node)
+                          {
+                              node_s *copy = (node_s*)target.allocate(node->kind, node_size(node->kind));
+                              std::memcpy((void*)copy, node, node_size(node->kind));
+                              if(!INLINE_VALUES || node->level != 0)
+                                  for(int tetrade = node_next_tetrade(copy, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(copy, tetrade + 1))
+                                      node_child(copy, tetrade)->next = &empty_node;
+                              slot->next = copy;
+                              return copy;
+                          }
+                          /*
+                           * Moves the subtree below slot into target, parents before their children. Only the copies are
+                           * written to, so the original stays intact until the caller switches over to them.
+                           */
+                          static void node_relocate(pool_type &target, union ptr_s *slot)
+                          {
+                              const node_s *node = slot->next;
+                              node_s *copy = (node_s*)target.allocate(node->kind, node_size(node->kind));
+                              std::memcpy((void*)copy, node, node_size(node->kind));
+                              slot->next = copy;
+                              if(node->level == 0)
+                                  return;
+
+                              for(int tetrade = node_next_tetrade(copy, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(copy, tetrade + 1))
+                                  node_relocate(target, node_child(copy, tetrade));
+                          }
+                          /*
+                           * Deep copy of the subtree below node into slot, depth first so that every subtree ends up in
+                           * one stretch of target's chunks.
+                           */
+                          size_type node_clone(pool_type &target, union ptr_s *slot, const node_s *node)
+                          {
+                              node_s *copy = node_shell(target, slot, node);
+                              if(node->level == 0 && INLINE_VALUES)
+                                  return node->count;
+
+                              size_type elements = node->level == 0 ? node->count : 0;
+                              for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                              {
+                                  const union ptr_s *child = node_child(node, tetrade);
+                                  if(node->level == 0)
+                                  {
+                                      mapped_type *value = alloc.allocate(1);
+                                      try
+                                      {
+                                          std::construct_at(value, *child->val);
+                                      }
+                                      catch(...)
+                                      {
+                                          alloc.deallocate(value, 1);
+                                          throw;
+                                      }
+                                      node_child(copy, tetrade)->val = value;
+                                  }
+                                  else
+                                      elements += node_clone(target, node_child(copy, tetrade), child->next);
+                              }
+                              return elements;
+                          }
+                          /*
+                           * Copies other into this (empty) map. With more than one thread the nodes of the top few levels
+                           * are copied here, breadth first until there are enough subtrees below them to keep every
+                           * thread busy, and the subtrees are cloned by workers taking them in turn.
+                           */
+                          void clone_from(const arraymap &other, unsigned int threads)
+                          {
+                              if(other.empty())
+                                  return;
+
+                              try
+                              {
+                                  if(threads <= 1)
+                                      node_clone(pool, &root, other.root.next);
+                                  else
+                                      clone_parallel(other, threads);
+                              }
+                              catch(...)
+                              {
+                                  stats_tree([&](unsigned int kind, std::size_t count){ hooks.node_allocated(kind, count); });
+                                  clear();
+                                  throw;
+                              }
+                              stats_tree([&](unsigned int kind, std::size_t count){ hooks.node_allocated(kind, count); });
+                              element_count = other.element_count;
+                              version++;
+                          }
+                          void clone_parallel(const arraymap &other, unsigned int threads)
+                          {
+                              typedef std::pair<union ptr_s*, const node_s*> clone_task;
+                              std::vector<clone_task> pending{ {&root, other.root.next} }, tasks;
+                              for(std::size_t head = 0; head < pending.size(); head++)
+                              {
+                                  auto [slot, node] = pending[head];
+                                  if(node->level == 0 || pending.size() - head + tasks.size() >= threads * 4)
+                                  {
+                                      tasks.push_back(pending[head]);
+                                      continue;
+                                  }
+                                  node_s *copy = node_shell(pool, slot, node);
+                                  for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                                      pending.emplace_back(node_child(copy, tetrade), node_child(node, tetrade)->next);
+                              }
+
+                              std::vector<std::unique_ptr<pool_type>> pools;
+                              std::vector<std::exception_ptr> errors(threads);
+                              for(unsigned int i = 0; i < threads; i++)
+                                  pools.push_back(std::make_unique<pool_type>(alloc));
+                              std::atomic<std::size_t> next(0);
+                              auto work = [&](unsigned int worker)
+                              {
+                                  try
+                                  {
+                                      for(std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < tasks.size();)
+                                          node_clone(*pools[worker], tasks[i].first, tasks[i].second);
+                                  }
+                                  catch(...)
+                                  {
+                                      errors[worker] = std::current_exception();
+                                      next.store(tasks.size(), std::memory_order_relaxed);
+                                  }
+                              };
+
+                              std::vector<std::thread> workers;
+                              for(unsigned int i = 1; i < threads && i < tasks.size(); i++)
+                                  workers.emplace_back(work, i);
+                              work(0);
+                              for(std::thread &worker : workers)
+                                  worker.join();
+
+                              for(std::unique_ptr<pool_type> &worker_pool : pools)
+                                  pool.splice(*worker_pool);
+                              for(std::exception_ptr &error : errors)
+                                  if(error)
+                                      std::rethrow_exception(error);
+                          }
+                          /*
+                           * Runs work(i) for every i below count on up to threads threads, each taking the next i in turn.
+                           * The first exception thrown stops the others from taking more and is rethrown once they are done.
+                           */
+                          template<class Work>
+                              static void run_parallel(unsigned int threads, std::size_t count, Work work)
+                              {
+                                  std::atomic<std::size_t> next(0);
+                                  std::exception_ptr error;
+                                  std::mutex error_lock;
+                                  auto worker = [&]()
+                                  {
+                                      try
+                                      {
+                                          for(std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+                                              work(i);
+                                      }
+                                      catch(...)
+                                      {
+                                          std::lock_guard<std::mutex> lock(error_lock);
+                                          if(!error)
+                                              error = std::current_exception();
+                                          next.store(count, std::memory_order_relaxed);
+                                      }
+                                  };
+
+                                  std::vector<std::thread> workers;
+                                  for(unsigned int i = 1; i < threads && i < count; i++)
+                                      workers.emplace_back(worker);
+                                  worker();
+                                  for(std::thread &thread : workers)
+                                      thread.join();
+                                  if(error)
+                                      std::rethrow_exception(error);
+                              }
+                          static constexpr std::size_t IMAGE_ALIGN = 64;
+                          struct image_header_s{
+                              char magic[8];
+                              std::uint32_t format;
+                              std::uint32_t byte_order;
+                              std::uint16_t key_size;
+                              std::uint16_t value_size;
+                              std::uint8_t radix_bits;
+                              std::uint8_t max_depth;
+                              std::uint8_t inline_values;
+                              std::uint8_t reserved;
+                              std::uint32_t node_sizes[4];
+                              std::uint64_t ordering;
+                              std::uint64_t element_count;
+                              std::uint64_t root;
+                              std::uint64_t size;
+                          };
+                          struct image_writer_s{
+                              std::ostream &out;
+                              std::uint64_t offset;
+                              std::vector<unsigned char> buffers[MAX_DEPTH];
+
+                              std::uint64_t put(const void *data, std::size_t size, std::size_t align)
+                              {
+                                  static const char padding[IMAGE_ALIGN] = {};
+                                  std::uint64_t start = (offset + align - 1) & ~(std::uint64_t)(align - 1);
+                                  out.write(padding, start - offset);
+                                  out.write((const char*)data, size);
+                                  offset = start + size;
+                                  return start;
+                              }
+                          };
+                          /*
+                           * Everything an image has to agree on with the map reading it, the ordering is told apart by
+                           * what it makes of a few keys.
+                           */
+                          static image_header_s image_header()
+                          {
+                              image_header_s header;
+                              std::memset(&header, 0, sizeof(header));
+                              std::memcpy(header.magic, "ARRAYMAP", sizeof(header.magic));
+                              header.format = 1;
+                              header.byte_order = 0x01020304;
+                              header.key_size = sizeof(radix_type);
+                              header.value_size = sizeof(mapped_type);
+                              header.radix_bits = RADIX_BITS;
+                              header.max_depth = MAX_DEPTH;
+                              header.inline_values = INLINE_VALUES;
+                              header.node_sizes[NODE_SMALL] = sizeof(small_node_s);
+                              header.node_sizes[NODE_MEDIUM] = sizeof(medium_node_s);
+                              header.node_sizes[NODE_FULL] = sizeof(full_node_s);
+                              header.node_sizes[NODE_LEAF] = sizeof(leaf_node_s);
+                              header.ordering = ordering_fingerprint();
+                              return header;
+                          }
+                          static std::uint64_t ordering_fingerprint()
+                          {
+                              std::uint64_t hash = 0xcbf29ce484222325;
+                              for(unsigned int probe = 0; probe < 4; probe++)
+                              {
+                                  unsigned char bytes[sizeof(radix_type)];
+                                  for(unsigned int i = 0; i < sizeof(radix_type); i++)
+                                      bytes[i] = probe * 0x55 + i * 37;
+                                  radix_type key;
+                                  std::memcpy(&key, bytes, sizeof(radix_type));
+                                  /*
+                                   * A projection is probed from the radix side, which at least catches one that does
+                                   * not round trip.
+                                   */
+                                  if constexpr(std::is_same<radix_type, key_type>::value)
+                                      key = Ordering::apply(key);
+                                  else
+                                      key = Ordering::apply(Ordering::restore(key));
+                                  std::memcpy(bytes, &key, sizeof(radix_type));
+                                  for(unsigned char byte : bytes)
+                                      hash = (hash ^ byte) * 0x100000001b3;
+                              }
+                              return hash;
+                          }
+                          static void stats_add(memory_stats_type &stats, node_kind kind, unsigned int children, unsigned int depth)
+                          {
+                              stats.nodes++;
+                              stats.nodes_per_depth[depth]++;
+                              stats.nodes_per_kind[kind]++;
+                              stats.node_bytes += node_size(kind);
+                              stats.node_bytes_per_depth[depth] += node_size(kind);
+                              stats.slots += children;
+                              stats.capacity += kind == NODE_LEAF ? FANOUT : node_capacity(kind);
+                          }
+                          static void stats_node(memory_stats_type &stats, const node_s *node, unsigned int depth)
+                          {
+                              stats_add(stats, node->kind, node->count, depth);
+                              if(node->level != 0)
+                                  for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                                      stats_node(stats, node_child(node, tetrade)->next, depth + 1);
+                          }
+                          /*
+                           * Same recursion as bulk_node, counting the nodes instead of making them.
+                           */
+                          static void estimate_node(memory_stats_type &stats, const radix_type *keys, std::size_t count, unsigned short level, unsigned int depth)
+                          {
+                              unsigned int children = bulk_children(keys, count, level);
+                              stats_add(stats, bulk_kind(children, level), children, depth);
+                              if(level == 0)
+                                  return;
+                              for(std::size_t begin = 0, end; begin < count; begin = end)
+                              {
+                                  tetrade_type tetrade = tetradeValue((const unsigned char*)(keys + begin), level);
+                                  for(end = begin + 1; end < count && tetradeValue((const unsigned char*)(keys + end), level) == tetrade; end++);
+                                  estimate_node(stats, keys + begin, end - begin, split_level(keys[begin], keys[end - 1]), depth + 1);
+                              }
+                          }
+                          /*
+                           * Reports the nodes of the whole tree by kind, for clear() and copies, which free
+                           * and build them without going through node_free and node_new.
+                           */
+                          template<class F>
+                              void stats_tree(F &&report) const
+                              {
+                                  stats_tree(root.next, report);
+                              }
+                          template<class F>
+                              void stats_tree(const node_s *node, F &&report) const
+                              {
+                                  if constexpr(STATS)
+                                  {
+                                      if(node == &empty_node)
+                                          return;
+                                      memory_stats_type stats{};
+                                      stats_node(stats, node, 0);
+                                      for(unsigned int kind = 0; kind < stats.nodes_per_kind.size(); kind++)
+                                          if(stats.nodes_per_kind[kind] != 0)
+                                              report(kind, stats.nodes_per_kind[kind]);
+                                  }
+                              }
+                          static memory_stats_type stats_finish(memory_stats_type &stats, size_type elements)
+                          {
+                              stats.elements = elements;
+                              stats.value_bytes = INLINE_VALUES ? 0 : elements * sizeof(mapped_type);
+                              stats.slots_per_node = stats.nodes ? (double)stats.slots / stats.nodes : 0;
+                              stats.fill_factor = stats.capacity ? (double)stats.slots / stats.capacity : 0;
+                              stats.bytes_per_element = elements ? (double)(stats.node_bytes + stats.value_bytes) / elements : 0;
+                              return stats;
+                          }
+                          static constexpr std::size_t STREAM_CHUNK = 4096;
+                          struct stream_header_s{
+                              char magic[8];
+                              std::uint32_t format;
+                              std::uint32_t byte_order;
+                              std::uint64_t key_size;
+                              std::uint64_t value_size;
+                              std::uint64_t ordering;
+                          };
+                          static stream_header_s stream_header()
+                          {
+                              stream_header_s header;
+                              std::memset(&header, 0, sizeof(header));
+                              std::memcpy(header.magic, "ARRAYMAs", sizeof(header.magic));
+                              header.format = 1;
+                              header.byte_order = 0x01020304;
+                              header.key_size = sizeof(radix_type);
+                              header.value_size = sizeof(mapped_type);
+                              header.ordering = ordering_fingerprint();
+                              return header;
+                          }
+                          /*
+                           * Applied keys as unsigned numbers, least significant word first, for the key deltas of streams.
+                           */
+                          static constexpr unsigned int KEY_WORDS = (sizeof(radix_type) + 7) / 8;
+                          typedef std::array<std::uint64_t, KEY_WORDS> key_number;
+                          static key_number to_number(const unsigned char *key_bytes)
+                          {
+                              key_number number{};
+                              for(unsigned int i = 0; i < sizeof(radix_type); i++)
+                                  number[i / 8] |= (std::uint64_t)key_bytes[i] << (i % 8 * 8);
+                              return number;
+                          }
+                          static radix_type from_number(const key_number &number)
+                          {
+                              unsigned char key_bytes[sizeof(radix_type)];
+                              for(unsigned int i = 0; i < sizeof(radix_type); i++)
+                                  key_bytes[i] = number[i / 8] >> (i % 8 * 8);
+                              radix_type key;
+                              std::memcpy(&key, key_bytes, sizeof(radix_type));
+                              return key;
+                          }
+                          static key_number subtract(key_number a, const key_number &b)
+                          {
+                              std::uint64_t borrow = 0;
+                              for(unsigned int i = 0; i < KEY_WORDS; i++)
+                              {
+                                  std::uint64_t word = a[i] - b[i] - borrow;
+                                  borrow = a[i] < b[i] || (a[i] == b[i] && borrow);
+                                  a[i] = word;
+                              }
+                              return a;
+                          }
+                          /*
+                           * a += b, false if the sum no longer fits a key.
+                           */
+                          static bool add(key_number &a, const key_number &b)
+                          {
+                              std::uint64_t carry = 0;
+                              for(unsigned int i = 0; i < KEY_WORDS; i++)
+                              {
+                                  std::uint64_t word = a[i] + b[i] + carry;
+                                  carry = word < a[i] || (word == a[i] && carry);
+                                  a[i] = word;
+                              }
+                              if constexpr(sizeof(radix_type) % 8 != 0)
+                                  return carry == 0 && (a[KEY_WORDS - 1] >> (sizeof(radix_type) % 8 * 8)) == 0;
+                              return carry == 0;
+                          }
+                          static void put_varint(std::vector<unsigned char> &out, key_number number)
+                          {
+                              for(;;)
+                              {
+                                  unsigned char byte = number[0] & 0x7F;
+                                  for(unsigned int i = 0; i < KEY_WORDS; i++)
+                                      number[i] = (number[i] >> 7) | (i + 1 < KEY_WORDS ? number[i + 1] << 57 : 0);
+                                  if(number == key_number{})
+                                  {
+                                      out.push_back(byte);
+                                      return;
+                                  }
+                                  out.push_back(byte | 0x80);
+                              }
+                          }
+                          template<class Source>
+                              struct stream_reader_s{
+                                  Source &source;
+                                  std::vector<unsigned char> buffer;
+                                  std::size_t position;
+                                  std::size_t end;
+
+                                  void refill()
+                                  {
+                                      end = source(buffer.data(), buffer.size());
+                                      position = 0;
+                                      if(end == 0)
+                                          throw std::runtime_error("arraymap::deserialize: stream ends early");
+                                  }
+                                  unsigned char get()
+                                  {
+                                      if(position == end)
+                                          refill();
+                                      return buffer[position++];
+                                  }
+                                  void read(void *data, std::size_t size)
+                                  {
+                                      for(unsigned char *out = (unsigned char*)data; size > 0;)
+                                      {
+                                          if(position == end)
+                                              refill();
+                                          std::size_t part = std::min(size, end - position);
+                                          std::memcpy(out, buffer.data() + position, part);
+                                          position += part;
+                                          out += part;
+                                          size -= part;
+                                      }
+                                  }
+                                  key_number varint()
+                                  {
+                                      key_number number{};
+                                      for(unsigned int shift = 0;; shift += 7)
+                                      {
+                                          if(shift >= KEY_WORDS * 64)
+                                              throw std::runtime_error("arraymap::deserialize: corrupt stream");
+                                          std::uint64_t bits = get();
+                                          number[shift / 64] |= (bits & 0x7F) << (shift % 64);
+                                          if(shift % 64 > 57 && shift / 64 + 1 < KEY_WORDS)
+                                              number[shift / 64 + 1] |= (bits & 0x7F) >> (64 - shift % 64);
+                                          if(!(bits & 0x80))
+                                              return number;
+                                      }
+                                  }
+                              };
+                          /*
+                           * Writes the subtree below node and returns where its root went. The copy written starts out
+                           * zeroed, so empty slots read as offset 0 and no stale memory ends up in the file.
+                           */
+                          static std::uint64_t save_node(image_writer_s &writer, const node_s *node)
+                          {
+                              std::vector<unsigned char> &buffer = writer.buffers[node->level];
+                              buffer.assign(node_size(node->kind), 0);
+                              node_s *image = (node_s*)buffer.data();
+                              image->kind = node->kind;
+                              image->level = node->level;
+                              std::memcpy(image->prefix, node->prefix, sizeof(radix_type));
+
+                              for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                              {
+                                  if(INLINE_VALUES && node->kind == NODE_LEAF)
+                                  {
+                                      static_cast<leaf_node_s*>(image)->mask.set(tetrade);
+                                      if constexpr(!EMPTY_VALUES)
+                                          std::memcpy(leaf_slot(static_cast<leaf_node_s*>(image), tetrade), leaf_value(node, tetrade), sizeof(mapped_type));
+                                      continue;
+                                  }
+
+                                  union ptr_s *slot;
+                                  if(node->kind == NODE_FULL)
+                                  {
+                                      static_cast<full_node_s*>(image)->mask.set(tetrade);
+                                      slot = static_cast<full_node_s*>(image)->child + tetrade;
+                                  }
+                                  else if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                      slot = sorted_insert(static_cast<medium_node_s*>(image), tetrade);
+                                  else
+                                      slot = sorted_insert(static_cast<small_node_s*>(image), tetrade);
+
+                                  const union ptr_s *child = node_child(node, tetrade);
+                                  std::uint64_t offset = node->level == 0 ? writer.put(child->val, sizeof(mapped_type), alignof(mapped_type)) : save_node(writer, child->next);
+                                  slot->next = (node_s*)(std::uintptr_t)offset;
+                                  if constexpr(COUNTED)
+                                      if(node->level != 0)
+                                          slot_count(image, slot) = slot_count(node, child);
+                              }
+                              image->count = node->count;
+                              return writer.put(buffer.data(), buffer.size(), alignof(std::max_align_t));
+                          }
+                          static unsigned int node_capacity(node_kind kind)
+                          {
+                              return kind == NODE_SMALL ? SMALL_NODE_SIZE : kind == NODE_MEDIUM ? MEDIUM_NODE_SIZE : FANOUT;
+                          }
+                          template<class node_t>
+                              static union ptr_s *sorted_child(node_t *node, tetrade_type tetrade)
+                              {
+                                  constexpr unsigned int N = sizeof(node->tetrades) / sizeof(tetrade_type);
+                                  unsigned int i = tetrade_search<tetrade_type, N>::find(node->tetrades, tetrade, node->count);
+                                  return i < node->count ? node->child + i : empty_node.child;
+                              }
+                          template<class node_t>
+                              static int sorted_next_tetrade(const node_t *node, int tetrade)
+                              {
+                                  for(unsigned int i = 0; i < node->count; i++)
+                                      if(node->tetrades[i] >= tetrade) return node->tetrades[i];
+                                  return FANOUT;
+                              }
+                          template<class node_t>
+                              static int sorted_prev_tetrade(const node_t *node, int tetrade)
+                              {
+                                  for(int i = node->count - 1; i >= 0; i--)
+                                      if(node->tetrades[i] <= tetrade) return node->tetrades[i];
+                                  return -1;
+                              }
+                          template<class node_t>
+                              static union ptr_s *sorted_insert(node_t *node, tetrade_type tetrade)
+                              {
+                                  int i = node->count++;
+                                  for(; i > 0 && node->tetrades[i - 1] > tetrade; i--)
+                                  {
+                                      node->tetrades[i] = node->tetrades[i - 1];
+                                      node->child[i] = node->child[i - 1];
+                                      if constexpr(COUNTED)
+                                          node->counts.size[i] = node->counts.size[i - 1];
+                                  }
+                                  node->tetrades[i] = tetrade;
+                                  node->child[i].next = &empty_node;
+                                  if constexpr(COUNTED)
+                                      node->counts.size[i] = 0;
+                                  return node->child + i;
+                              }
+                          template<class node_t>
+                              static void sorted_remove(node_t *node, tetrade_type tetrade)
+                              {
+                                  unsigned int i = 0;
+                                  for(; node->tetrades[i] != tetrade; i++);
+                                  for(node->count--; i < node->count; i++)
+                                  {
+                                      node->tetrades[i] = node->tetrades[i + 1];
+                                      node->child[i] = node->child[i + 1];
+                                      if constexpr(COUNTED)
+                                          node->counts.size[i] = node->counts.size[i + 1];
+                                  }
+                              }
+                          static union ptr_s *node_child(node_s *node, tetrade_type tetrade)
+                          {
+                              if(node->kind == NODE_FULL)
+                                  return static_cast<full_node_s*>(node)->child + tetrade;
+                              if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                  return sorted_child(static_cast<medium_node_s*>(node), tetrade);
+                              return sorted_child(static_cast<small_node_s*>(node), tetrade);
+                          }
+                          static const union ptr_s *node_child(const node_s *node, tetrade_type tetrade)
+                          {
+                              return node_child(const_cast<node_s*>(node), tetrade);
+                          }
+                          /*
+                           * Number of elements below the child slot of a node above level 0 (with Counted only).
+                           */
+                          static size_type &slot_count(node_s *node, const union ptr_s *slot)
+                          {
+                              if(node->kind == NODE_FULL)
+                                  return static_cast<full_node_s*>(node)->counts.size[slot - static_cast<full_node_s*>(node)->child];
+                              if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                  return static_cast<medium_node_s*>(node)->counts.size[slot - static_cast<medium_node_s*>(node)->child];
+                              return static_cast<small_node_s*>(node)->counts.size[slot - static_cast<small_node_s*>(node)->child];
+                          }
+                          static size_type slot_count(const node_s *node, const union ptr_s *slot)
+                          {
+                              return slot_count(const_cast<node_s*>(node), slot);
+                          }
+                          static size_type subtree_size(const node_s *node)
+                          {
+                              if(node->level == 0)
+                                  return node->count;
+                              size_type size = 0;
+                              for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                                  size += slot_count(node, node_child(node, tetrade));
+                              return size;
+                          }
+                          /*
+                           * Adds delta to the counts along the path of a key that is in the map.
+                           */
+                          void count_path(const unsigned char *key_bytes, std::ptrdiff_t delta)
+                          {
+                              for(node_s *node = root.next; node->level != 0;)
+                              {
+                                  union ptr_s *child = node_child(node, tetradeValue(key_bytes, node->level));
+                                  slot_count(node, child) += delta;
+                                  node = child->next;
+                              }
+                          }
+                          static int node_next_tetrade(const node_s *node, int tetrade)
+                          {
+                              if(INLINE_VALUES && node->kind == NODE_LEAF)
+                                  return static_cast<const leaf_node_s*>(node)->mask.next(tetrade);
+                              if(node->kind == NODE_FULL)
+                                  return static_cast<const full_node_s*>(node)->mask.next(tetrade);
+                              if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                  return sorted_next_tetrade(static_cast<const medium_node_s*>(node), tetrade);
+                              return sorted_next_tetrade(static_cast<const small_node_s*>(node), tetrade);
+                          }
+                          static int node_prev_tetrade(const node_s *node, int tetrade)
+                          {
+                              if(INLINE_VALUES && node->kind == NODE_LEAF)
+                                  return static_cast<const leaf_node_s*>(node)->mask.prev(tetrade);
+                              if(node->kind == NODE_FULL)
+                                  return static_cast<const full_node_s*>(node)->mask.prev(tetrade);
+                              if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                  return sorted_prev_tetrade(static_cast<const medium_node_s*>(node), tetrade);
+                              return sorted_prev_tetrade(static_cast<const small_node_s*>(node), tetrade);
+                          }
+                          /*
+                           * Moves the node behind slot into a new node of the given kind.
+                           */
+                          void node_resize(union ptr_s *slot, node_kind kind)
+                          {
+                              node_s *node = slot->next;
+                              node_s *resized = node_new(kind, node->level, node->prefix);
+
+                              for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                              {
+                                  union ptr_s *child;
+                                  if(kind == NODE_FULL)
+                                  {
+                                      static_cast<full_node_s*>(resized)->mask.set(tetrade);
+                                      child = static_cast<full_node_s*>(resized)->child + tetrade;
+                                  }
+                                  else if(kind == NODE_MEDIUM)
+                                      child = sorted_insert(static_cast<medium_node_s*>(resized), tetrade);
+                                  else
+                                      child = sorted_insert(static_cast<small_node_s*>(resized), tetrade);
+                                  *child = *node_child(node, tetrade);
+                                  if constexpr(COUNTED)
+                                      if(node->level != 0)
+                                          slot_count(resized, child) = slot_count(node, node_child(node, tetrade));
+                              }
+                              resized->count = node->count;
+
+                              node_free(node);
+                              slot->next = resized;
+                              version++;
+                          }
+                          /*
+                           * Makes room for a child that is not yet present and returns its (still empty) slot,
+                           * growing the node behind slot into the next kind if needed.
+                           */
+                          union ptr_s *node_add_child(union ptr_s *slot, tetrade_type tetrade)
+                          {
+                              if(slot->next->kind != NODE_FULL && slot->next->count == node_capacity(slot->next->kind))
+                                  node_resize(slot, HAS_MEDIUM_NODE && slot->next->kind == NODE_SMALL ? NODE_MEDIUM : NODE_FULL);
+
+                              node_s *node = slot->next;
+                              if(node->kind == NODE_FULL)
+                              {
+                                  node->count++;
+                                  static_cast<full_node_s*>(node)->mask.set(tetrade);
+                                  if constexpr(COUNTED)
+                                      static_cast<full_node_s*>(node)->counts.size[tetrade] = 0;
+                                  return static_cast<full_node_s*>(node)->child + tetrade;
+                              }
+
+                              version++;
+                              if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                  return sorted_insert(static_cast<medium_node_s*>(node), tetrade);
+                              return sorted_insert(static_cast<small_node_s*>(node), tetrade);
+                          }
+                          /*
+                           * Removes a present child, freeing the node behind slot once its last child is gone
+                           * and shrinking it into the smaller kind when few enough children are left.
+                           * An interior node left with a single child is merged away by pointing slot at that child.
+                           */
+                          void node_remove_child(union ptr_s *slot, tetrade_type tetrade)
+                          {
+                              node_remove_child(slot, tetrade, true);
+                          }
+                          void node_remove_child(union ptr_s *slot, tetrade_type tetrade, bool mergeable)
+                          {
+                              node_s *node = slot->next;
+                              version++;
+
+                              if(node->count == 1)
+                              {
+                                  node_free(node);
+                                  slot->next = &empty_node;
+                                  return;
+                              }
+
+                              if(node->count == 2 && node->level != 0 && mergeable)
+                              {
+                                  int other = node_next_tetrade(node, 0);
+                                  if(other == tetrade)
+                                      other = node_next_tetrade(node, tetrade + 1);
+                                  slot->next = node_child(node, other)->next;
+                                  node_free(node);
+                                  return;
+                              }
+
+                              if(INLINE_VALUES && node->kind == NODE_LEAF)
+                              {
+                                  static_cast<leaf_node_s*>(node)->mask.reset(tetrade);
+                                  node->count--;
+                              }
+                              else if(node->kind == NODE_FULL)
+                              {
+                                  static_cast<full_node_s*>(node)->child[tetrade].next = &empty_node;
+                                  static_cast<full_node_s*>(node)->mask.reset(tetrade);
+                                  node->count--;
+                                  if(node->count <= (HAS_MEDIUM_NODE ? SHRINK_MEDIUM_NODE_SIZE : SHRINK_NODE_SIZE))
+                                      node_resize(slot, HAS_MEDIUM_NODE ? NODE_MEDIUM : NODE_SMALL);
+                              }
+                              else if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                              {
+                                  sorted_remove(static_cast<medium_node_s*>(node), tetrade);
+                                  if(node->count <= SHRINK_NODE_SIZE)
+                                      node_resize(slot, NODE_SMALL);
+                              }
+                              else
+                                  sorted_remove(static_cast<small_node_s*>(node), tetrade);
+                          }
+                          /*
+                           * Destroys the values below ptr, the nodes themselves go back to the pool all at once.
+                           */
+                          void free_values(union ptr_s *ptr)
+                          {
+                              if(INLINE_VALUES || is_empty(*ptr)) return;
+
+                              node_s *node = ptr->next;
+                              for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                              {
+                                  union ptr_s *child = node_child(node, tetrade);
+                                  if(is_empty(*child))
+                                      continue;
+                                  if(node->level == 0) 
+                                  {
+                                      std::destroy_at(child->val);
+                                      alloc.deallocate(child->val, 1);
+                                  }
+                                  else
+                                      free_values(child);
+                              }
+                          }
+                          /*
+                           * Erases the (applied) keys from lo to hi, both included.
+                           */
+                          size_type range_erase(const radix_type &lo, const radix_type &hi)
+                          {
+                              if(is_empty(root))
+                                  return 0;
+                              size_type erased = range_erase(&root, lo, hi);
+                              element_count -= erased;
+                              version++;
+                              return erased;
+                          }
+                          /*
+                           * The node behind slot covers every key sharing its prefix above its level. If that lies
+                           * wholly inside the range the subtree goes at once, otherwise only the children that overlap
+                           * the range are visited and a node left with a single child is merged away afterwards
+                           * (removing the children one by one must not merge, the node is still being walked).
+                           */
+                          size_type range_erase(union ptr_s *slot, const radix_type &lo, const radix_type &hi)
+                          {
+                              node_s *node = slot->next;
+                              unsigned int level = node->level;
+                              radix_type low, high;
+                              std::memcpy(&low, node->prefix, sizeof(radix_type));
+                              std::memcpy(&high, node->prefix, sizeof(radix_type));
+                              for(unsigned int i = 0; i <= level; i++)
+                              {
+                                  setTetrade((unsigned char*)&low, i, 0);
+                                  setTetrade((unsigned char*)&high, i, FANOUT - 1);
+                              }
+                              if(key_less(high, lo) || key_less(hi, low))
+                                  return 0;
+                              if(!key_less(low, lo) && !key_less(hi, high))
+                              {
+                                  slot->next = &empty_node;
+                                  return free_tree(node);
+                              }
+
+                              int first = key_less(low, lo) ? tetradeValue((const unsigned char*)&lo, level) : 0;
+                              int last = key_less(hi, high) ? tetradeValue((const unsigned char*)&hi, level) : FANOUT - 1;
+                              size_type erased = 0;
+                              for(int tetrade = node_next_tetrade(node, first); tetrade <= last; tetrade = node_next_tetrade(slot->next, tetrade + 1))
+                              {
+                                  node = slot->next;
+                                  if(level == 0)
+                                  {
+                                      mapped_type *value = leaf_value(node, tetrade);
+                                      std::destroy_at(value);
+                                      if constexpr(!INLINE_VALUES)
+                                          alloc.deallocate(value, 1);
+                                      erased++;
+                                  }
+                                  else
+                                  {
+                                      union ptr_s *child = node_child(node, tetrade);
+                                      size_type below = range_erase(child, lo, hi);
+                                      erased += below;
+                                      if(!is_empty(*child))
+                                      {
+                                          if constexpr(COUNTED)
+                                              slot_count(node, child) -= below;
+                                          continue;
+                                      }
+                                  }
+
+                                  if(node->count == 1)
+                                  {
+                                      hooks.prune(level);
+                                      node_remove_child(slot, tetrade, false);
+                                      return erased;
+                                  }
+                                  node_remove_child(slot, tetrade, false);
+                              }
+
+                              node = slot->next;
+                              if(node->count == 1 && level != 0)
+                              {
+                                  slot->next = node_child(node, node_next_tetrade(node, 0))->next;
+                                  hooks.prune(level);
+                                  node_free(node);
+                              }
+                              return erased;
+                          }
+                          /*
+                           * Frees a subtree that is already unhooked, values included, and returns how many it held.
+                           */
+                          size_type free_tree(node_s *node)
+                          {
+                              size_type erased = 0;
+                              if(node->level == 0)
+                                  erased = node->count;
+                              if(!INLINE_VALUES || node->level != 0)
+                                  for(int tetrade = node_next_tetrade(node, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(node, tetrade + 1))
+                                  {
+                                      union ptr_s *child = node_child(node, tetrade);
+                                      if(node->level != 0)
+                                          erased += free_tree(child->next);
+                                      else
+                                      {
+                                          std::destroy_at(child->val);
+                                          alloc.deallocate(child->val, 1);
+                                      }
+                                  }
+                              hooks.prune(node->level);
+                              node_free(node);
+                              return erased;
+                          }
+                          enum combine_op { COMBINE_INTERSECTION, COMBINE_UNION, COMBINE_DIFFERENCE };
+                          static arraymap combined(const arraymap &a, const arraymap &b, combine_op op)
+                          {
+                              arraymap result(alloc_traits::select_on_container_copy_construction(a.alloc));
+                              result.element_count = result.combine(&result.root, is_empty(a.root) ? nullptr : a.root.next, is_empty(b.root) ? nullptr : b.root.next, op);
+                              return result;
+                          }
+                          /*
+                           * Builds into the empty slot the keys of the subtrees a and b (either may be missing) that op
+                           * keeps and returns how many. The node at the higher level of the two branches, the other one
+                           * lies below a single child of it, unless their prefixes differ above both and they share no
+                           * keys at all. A subtree only one side has is copied whole, or skipped, without looking at
+                           * the other. Values come from a wherever it has them.
+                           */
+                          size_type combine(union ptr_s *slot, const node_s *a, const node_s *b, combine_op op)
+                          {
+                              if(a == nullptr && b == nullptr)
+                                  return 0;
+                              if(b == nullptr)
+                                  return op == COMBINE_INTERSECTION ? 0 : clone_subtree(slot, a);
+                              if(a == nullptr)
+                                  return op == COMBINE_UNION ? clone_subtree(slot, b) : 0;
+
+                              const node_s *upper = a->level >= b->level ? a : b;
+                              const node_s *lower = upper == a ? b : a;
+                              unsigned int level = upper->level;
+                              int split = prefix_mismatch(lower->prefix, upper);
+                              if(split >= 0 && op != COMBINE_UNION)
+                                  return op == COMBINE_DIFFERENCE ? clone_subtree(slot, a) : 0;
+
+                              slot->next = node_new(split >= 0 ? NODE_SMALL : level == 0 ? LEAF_KIND : NODE_SMALL, split >= 0 ? split : level, upper->prefix);
+                              size_type elements = 0;
+                              if(split >= 0)
+                              {
+                                  for(const node_s *side : { a, b })
+                                      elements += combine_child(slot, tetradeValue(side->prefix, split), side == a ? a : nullptr, side == b ? b : nullptr, op);
+                                  return elements;
+                              }
+
+                              auto below = [&](const node_s *node, int tetrade) -> const node_s*
+                              {
+                                  if(node->level != level)
+                                      return tetradeValue(node->prefix, level) == tetrade ? node : nullptr;
+                                  const union ptr_s *child = node_child(node, tetrade);
+                                  return level == 0 || is_empty(*child) ? nullptr : child->next;
+                              };
+                              auto next = [&](const node_s *node, int tetrade)
+                              {
+                                  if(node->level == level)
+                                      return node_next_tetrade(node, tetrade);
+                                  int only = tetradeValue(node->prefix, level);
+                                  return only >= tetrade ? only : (int)FANOUT;
+                              };
+                              for(int tetrade = std::min(next(a, 0), next(b, 0)); tetrade < (int)FANOUT; tetrade = std::min(next(a, tetrade + 1), next(b, tetrade + 1)))
+                              {
+                                  if(level == 0)
+                                  {
+                                      const mapped_type *in_a = leaf_value(a, tetrade), *in_b = leaf_value(b, tetrade);
+                                      if(op == COMBINE_INTERSECTION ? in_a != nullptr && in_b != nullptr : op == COMBINE_DIFFERENCE ? in_b == nullptr : true)
+                                      {
+                                          leaf_copy(slot, tetrade, in_a != nullptr ? *in_a : *in_b);
+                                          elements++;
+                                      }
+                                  }
+                                  else
+                                      elements += combine_child(slot, tetrade, below(a, tetrade), below(b, tetrade), op);
+                              }
+
+                              node_s *node = slot->next;
+                              if(elements == 0)
+                              {
+                                  node_free(node);
+                                  slot->next = &empty_node;
+                              }
+                              else if(node->count == 1 && level != 0)
+                              {
+                                  slot->next = node_child(node, node_next_tetrade(node, 0))->next;
+                                  node_free(node);
+                              }
+                              return elements;
+                          }
+                          /*
+                           * Combines a and b into a new child of the node behind slot, which is only added if it
+                           * gets any keys. Until then the subtree is unreachable, so its values are freed here if
+                           * copying one of them throws.
+                           */
+                          size_type combine_child(union ptr_s *slot, tetrade_type tetrade, const node_s *a, const node_s *b, combine_op op)
+                          {
+                              union ptr_s built;
+                              built.next = &empty_node;
+                              size_type elements;
+                              try
+                              {
+                                  elements = combine(&built, a, b, op);
+                              }
+                              catch(...)
+                              {
+                                  free_values(&built);
+                                  throw;
+                              }
+                              if(elements != 0)
+                              {
+                                  union ptr_s *child = node_add_child(slot, tetrade);
+                                  *child = built;
+                                  if constexpr(COUNTED)
+                                      slot_count(slot->next, child) = elements;
+                              }
+                              return elements;
+                          }
+                          size_type clone_subtree(union ptr_s *slot, const node_s *node)
+                          {
+                              size_type elements = node_clone(pool, slot, node);
+                              stats_tree(slot->next, [&](unsigned int kind, std::size_t count){ hooks.node_allocated(kind, count); });
+                              return elements;
+                          }
+                          void leaf_copy(union ptr_s *slot, tetrade_type tetrade, const mapped_type &value)
+                          {
+                              if constexpr(INLINE_VALUES)
+                                  std::construct_at(leaf_add(slot, tetrade), value);
+                              else
+                              {
+                                  mapped_type *copy = alloc.allocate(1);
+                                  try
+                                  {
+                                      std::construct_at(copy, value);
+                                  }
+                                  catch(...)
+                                  {
+                                      alloc.deallocate(copy, 1);
+                                      throw;
+                                  }
+                                  node_add_child(slot, tetrade)->val = copy;
+                              }
+                          }
+                          /*
+                           * Merges the subtree below incoming, whose nodes already belong to this map's pool, into the
+                           * one behind slot and returns how many of its keys were there already. Whichever side has the
+                           * higher level stays in slot, so the roles swap when incoming's node is the higher one, and
+                           * with them which side's values win (keep_slot).
+                           */
+                          size_type merge_into(union ptr_s *slot, node_s *incoming, bool keep_slot)
+                          {
+                              node_s *node = slot->next;
+                              const node_s *upper = node->level >= incoming->level ? node : incoming;
+                              int split = prefix_mismatch((upper == node ? incoming : node)->prefix, upper);
+                              if(split >= 0)
+                              {
+                                  slot->next = node_new(NODE_SMALL, split, node->prefix);
+                                  for(node_s *side : { node, incoming })
+                                  {
+                                      union ptr_s *child = node_add_child(slot, tetradeValue(side->prefix, split));
+                                      child->next = side;
+                                      if constexpr(COUNTED)
+                                          slot_count(slot->next, child) = subtree_size(side);
+                                  }
+                                  return 0;
+                              }
+                              if(incoming->level > node->level)
+                              {
+                                  slot->next = incoming;
+                                  std::swap(node, incoming);
+                                  keep_slot = !keep_slot;
+                              }
+                              unsigned int level = node->level;
+
+                              if(incoming->level < level)
+                              {
+                                  tetrade_type tetrade = tetradeValue(incoming->prefix, level);
+                                  union ptr_s *child = node_child(node, tetrade);
+                                  size_type size = 0;
+                                  if constexpr(COUNTED)
+                                      size = subtree_size(incoming);
+                                  if(is_empty(*child))
+                                  {
+                                      child = node_add_child(slot, tetrade);
+                                      child->next = incoming;
+                                      if constexpr(COUNTED)
+                                          slot_count(slot->next, child) = size;
+                                      return 0;
+                                  }
+                                  size_type duplicates = merge_into(child, incoming, keep_slot);
+                                  if constexpr(COUNTED)
+                                      slot_count(node, child) += size - duplicates;
+                                  return duplicates;
+                              }
+
+                              size_type duplicates = 0;
+                              for(int tetrade = node_next_tetrade(incoming, 0); tetrade < (int)FANOUT; tetrade = node_next_tetrade(incoming, tetrade + 1))
+                              {
+                                  if(level == 0)
+                                  {
+                                      mapped_type *value = leaf_value(incoming, tetrade);
+                                      mapped_type *present = leaf_value(slot->next, tetrade);
+                                      if(present != nullptr)
+                                      {
+                                          duplicates++;
+                                          if(!keep_slot)
+                                              *present = std::move(*value);
+                                          std::destroy_at(value);
+                                          if constexpr(!INLINE_VALUES)
+                                              alloc.deallocate(value, 1);
+                                      }
+                                      else if constexpr(INLINE_VALUES)
+                                          std::construct_at(leaf_add(slot, tetrade), std::move(*value));
+                                      else
+                                          node_add_child(slot, tetrade)->val = value;
+                                      continue;
+                                  }
+
+                                  union ptr_s *from = node_child(incoming, tetrade);
+                                  union ptr_s *child = node_child(slot->next, tetrade);
+                                  if(is_empty(*child))
+                                  {
+                                      child = node_add_child(slot, tetrade);
+                                      *child = *from;
+                                      if constexpr(COUNTED)
+                                          slot_count(slot->next, child) = slot_count(incoming, from);
+                                      continue;
+                                  }
+                                  size_type merged = merge_into(child, from->next, keep_slot);
+                                  duplicates += merged;
+                                  if constexpr(COUNTED)
+                                      slot_count(slot->next, child) += slot_count(incoming, from) - merged;
+                              }
+                              node_free(incoming);
+                              return duplicates;
+                          }
+                          size_type key_rank(const radix_type &key) const
+                          {
+                              const unsigned char *key_bytes = (const unsigned char*)&key;
+                              size_type rank = 0, size = element_count;
+                              for(const node_s *node = root.next; size != 0;)
+                              {
+                                  int split = prefix_mismatch(key_bytes, node);
+                                  if(split >= 0)
+                                      return tetradeValue(node->prefix, split) < tetradeValue(key_bytes, split) ? rank + size : rank;
+
+                                  int tetrade = tetradeValue(key_bytes, node->level);
+                                  if(node->level == 0)
+                                  {
+                                      for(int t = node_next_tetrade(node, 0); t < tetrade; t = node_next_tetrade(node, t + 1))
+                                          rank++;
+                                      return rank;
+                                  }
+                                  for(int t = node_next_tetrade(node, 0); t < tetrade; t = node_next_tetrade(node, t + 1))
+                                      rank += slot_count(node, node_child(node, t));
+
+                                  const union ptr_s *child = node_child(node, tetrade);
+                                  if(is_empty(*child))
+                                      break;
+                                  size = slot_count(node, child);
+                                  node = child->next;
+                              }
+                              return rank;
+                          }
+                          radix_type key_select(size_type k) const
+                          {
+                              const node_s *node = root.next;
+                              int tetrade = node_next_tetrade(node, 0);
+                              for(; node->level != 0; tetrade = node_next_tetrade(node, 0))
+                              {
+                                  for(size_type size; k >= (size = slot_count(node, node_child(node, tetrade))); tetrade = node_next_tetrade(node, tetrade + 1))
+                                      k -= size;
+                                  node = node_child(node, tetrade)->next;
+                              }
+                              for(; k > 0; k--)
+                                  tetrade = node_next_tetrade(node, tetrade + 1);
+
+                              radix_type key;
+                              std::memcpy((void*)&key, node->prefix, sizeof(radix_type));
+                              setTetrade((unsigned char*)&key, 0, tetrade);
+                              return key;
+                          }
+                          /*
+                           * Moves the values of a map with a different allocator over one by one, in key order so each
+                           * insert starts from the previous one. Keys already here keep their values, other ends up empty.
+                           */
+                          void move_elements(arraymap &other)
+                          {
+                              iterator hint = end();
+                              other.for_each([&](const key_type &key, mapped_type &value){ hint = try_emplace(hint, key, std::move(value)); });
+                              other.clear();
+                          }
+                          static void key_decrement(radix_type &key)
+                          {
+                              unsigned char *bytes = (unsigned char*)&key;
+                              for(unsigned int i = 0; i < sizeof(radix_type) && bytes[i]-- == 0; i++);
+                          }
+                          /*
+                           * key += 1, false if it was the largest key.
+                           */
+                          static bool key_increment(radix_type &key)
+                          {
+                              unsigned char *bytes = (unsigned char*)&key;
+                              for(unsigned int i = 0; i < sizeof(radix_type); i++)
+                                  if(++bytes[i] != 0)
+                                      return true;
+                              return false;
+                          }
+                          template<class cursor_t>
+                              static cursor_t exact_cursor(cursor_t found, const radix_type &key)
+                              {
+                                  if(found && std::memcmp(&found.position, &key, sizeof(radix_type)) != 0)
+                                      found.leaf = nullptr;
+                                  return found;
+                              }
+                          /*
+                           * Leaf holding the first key at or after key_bytes, with that key's tetrade, or nullptr when
+                           * there is none. Walks down the key's path remembering the deepest node with a child after it,
+                           * which is where the answer lies once the path leaves the tree.
+                           */
+                          const node_s *leaf_lower_bound(const unsigned char *key_bytes, int &tetrade) const
+                          {
+                              if(is_empty(root))
+                                  return nullptr;
+
+                              const node_s *node = root.next, *after = nullptr;
+                              int after_tetrade = 0;
+                              for(;;)
+                              {
+                                  int split = prefix_mismatch(key_bytes, node);
+                                  if(split >= 0)
+                                  {
+                                      if(tetradeValue(node->prefix, split) > tetradeValue(key_bytes, split))
+                                          after = nullptr;
+                                      else
+                                          node = nullptr;
+                                      break;
+                                  }
+
+                                  int own = tetradeValue(key_bytes, node->level);
+                                  if(node->level == 0)
+                                  {
+                                      tetrade = node_next_tetrade(node, own);
+                                      if(tetrade < (int)FANOUT)
+                                          return node;
+                                      node = nullptr;
+                                      break;
+                                  }
+                                  int next = node_next_tetrade(node, own + 1);
+                                  if(next < (int)FANOUT)
+                                  {
+                                      after = node;
+                                      after_tetrade = next;
+                                  }
+                                  const union ptr_s *child = node_child(node, own);
+                                  if(is_empty(*child))
+                                  {
+                                      node = nullptr;
+                                      break;
+                                  }
+                                  node = child->next;
+                              }
+
+                              if(node == nullptr)
+                              {
+                                  if(after == nullptr)
+                                      return nullptr;
+                                  node = node_child(after, after_tetrade)->next;
+                              }
+                              for(; node->level != 0; node = node_child(node, node_next_tetrade(node, 0))->next);
+                              tetrade = node_next_tetrade(node, 0);
+                              return node;
+                          }
+                          /*
+                           * Children of a node with child slots in tetrade order, read straight off its arrays.
+                           */
+                          template<class Fn>
+                              static void node_for_each_child(const node_s *node, Fn &&fn)
+                              {
+                                  if(node->kind == NODE_FULL)
+                                  {
+                                      const full_node_s *full = static_cast<const full_node_s*>(node);
+                                      for(int tetrade = full->mask.next(0); tetrade < (int)FANOUT; tetrade = full->mask.next(tetrade + 1))
+                                          fn(tetrade, full->child[tetrade]);
+                                  }
+                                  else if(HAS_MEDIUM_NODE && node->kind == NODE_MEDIUM)
+                                  {
+                                      const medium_node_s *medium = static_cast<const medium_node_s*>(node);
+                                      for(unsigned int i = 0; i < medium->count; i++)
+                                          fn(medium->tetrades[i], medium->child[i]);
+                                  }
+                                  else
+                                  {
+                                      const small_node_s *small = static_cast<const small_node_s*>(node);
+                                      for(unsigned int i = 0; i < small->count; i++)
+                                          fn(small->tetrades[i], small->child[i]);
+                                  }
+                              }
+                          template<class Value, class F>
+                              static void visit_tree(const node_s *node, F &f)
+                              {
+                                  if(node->level != 0)
+                                  {
+                                      node_for_each_child(node, [&](int, const union ptr_s &child){ visit_tree<Value>(child.next, f); });
+                                      return;
+                                  }
+                                  radix_type key;
+                                  std::memcpy((void*)&key, node->prefix, sizeof(radix_type));
+                                  if constexpr(INLINE_VALUES)
+                                  {
+                                      const leaf_node_s *leaf = static_cast<const leaf_node_s*>(node);
+                                      for(int tetrade = leaf->mask.next(0); tetrade < (int)FANOUT; tetrade = leaf->mask.next(tetrade + 1))
+                                      {
+                                          setTetrade((unsigned char*)&key, 0, tetrade);
+                                          f(Ordering::restore(key), (Value&)*leaf_slot(leaf, tetrade));
+                                      }
+                                  }
+                                  else
+                                      node_for_each_child(node, [&](int tetrade, const union ptr_s &child)
+                                              {
+                                                  setTetrade((unsigned char*)&key, 0, tetrade);
+                                                  f(Ordering::restore(key), (Value&)*child.val);
+                                              });
+                              }
+                          /*
+                           * Like range_erase, subtrees wholly inside [lo, hi] are handed to visit_tree and only the
+                           * nodes on the paths to lo and hi look at the bounds.
+                           */
+                          template<class Value, class F>
+                              static void visit_range(const node_s *node, const radix_type &lo, const radix_type &hi, F &f)
+                              {
+                                  unsigned int level = node->level;
+                                  radix_type low, high;
+                                  std::memcpy((void*)&low, node->prefix, sizeof(radix_type));
+                                  std::memcpy((void*)&high, node->prefix, sizeof(radix_type));
+                                  for(unsigned int i = 0; i <= level; i++)
+                                  {
+                                      setTetrade((unsigned char*)&low, i, 0);
+                                      setTetrade((unsigned char*)&high, i, FANOUT - 1);
+                                  }
+                                  if(key_less(high, lo) || key_less(hi, low))
+                                      return;
+                                  if(!key_less(low, lo) && !key_less(hi, high))
+                                  {
+                                      visit_tree<Value>(node, f);
+                                      return;
+                                  }
+
+                                  int first = key_less(low, lo) ? tetradeValue((const unsigned char*)&lo, level) : 0;
+                                  int last = key_less(hi, high) ? tetradeValue((const unsigned char*)&hi, level) : FANOUT - 1;
+                                  for(int tetrade = node_next_tetrade(node, first); tetrade <= last; tetrade = node_next_tetrade(node, tetrade + 1))
+                                  {
+                                      if(level != 0)
+                                      {
+                                          visit_range<Value>(node_child(node, tetrade)->next, lo, hi, f);
+                                          continue;
+                                      }
+                                      setTetrade((unsigned char*)&low, 0, tetrade);
+                                      f(Ordering::restore(low), (Value&)*leaf_value(node, tetrade));
+                                  }
+                              }
+                          static bool is_node_empty(const node_s *node) 
+                          {
+                              return node->count == 0;
+                          }
+                          /*
+                           * Highest level above the node's own where key and the node's prefix differ, -1 if there is none.
+                           */
+                          static int prefix_mismatch(const unsigned char *key_bytes, const node_s *node)
+                          {
+                              if constexpr(std::endian::native == std::endian::little && sizeof(radix_type) <= sizeof(std::uint64_t))
+                              {
+                                  std::uint64_t key = 0, prefix = 0;
+                                  std::memcpy(&key, key_bytes, sizeof(radix_type));
+                                  std::memcpy(&prefix, node->prefix, sizeof(radix_type));
+                                  unsigned int shift = (node->level + 1) * RADIX_BITS;
+                                  if(shift >= sizeof(radix_type) * 8) return -1;
+                                  std::uint64_t diff = (key ^ prefix) >> shift;
+                                  return diff == 0 ? -1 : (int)( 63 - std::countl_zero(diff) + shift ) / (int)RADIX_BITS;
+                              }
+                              for(int i = sizeof(radix_type) - 1; i >= (int)( (node->level + 1) * RADIX_BITS / 8 ); i--)
+                              {
+                                  unsigned char diff = key_bytes[i] ^ node->prefix[i];
+                                  if(diff == 0) continue;
+
+                                  int level = ( i * 8 + 7 - std::countl_zero(diff) ) / RADIX_BITS;
+                                  return level > node->level ? level : -1;
+                              }
+                              return -1;
+                          }
+                          static inline bool prefix_matches(const unsigned char *key_bytes, const node_s *node)
+                          {
+                              if constexpr(std::endian::native == std::endian::little && sizeof(radix_type) <= sizeof(std::uint64_t))
+                              {
+                                  std::uint64_t key = 0, prefix = 0;
+                                  std::memcpy(&key, key_bytes, sizeof(radix_type));
+                                  std::memcpy(&prefix, node->prefix, sizeof(radix_type));
+                                  unsigned int shift = (node->level + 1) * RADIX_BITS;
+                                  return shift >= sizeof(radix_type) * 8 || ( (key ^ prefix) >> shift ) == 0;
+                              }
+                              else
+                                  return prefix_mismatch(key_bytes, node) < 0;
+                          }
+                          /*
+                           * Child lookup for the iterators, which keep one stack entry per level. A slot whose node sits
+                           * below the given level stands for a node with the single child given by the node's prefix.
+                           */
+                          static union ptr_s *level_child(union ptr_s *slot, unsigned short level, tetrade_type tetrade)
+                          {
+                              if(slot->next->level == level || is_empty(*slot))
+                                  return node_child(slot->next, tetrade);
+
+                              return tetradeValue(slot->next->prefix, level) == tetrade ? slot : empty_node.child;
+                          }
+                          static int level_next_tetrade(const union ptr_s *slot, unsigned short level, int tetrade)
+                          {
+                              if(slot->next->level == level || is_empty(*slot))
+                                  return node_next_tetrade(slot->next, tetrade);
+
+                              int only = tetradeValue(slot->next->prefix, level);
+                              return only >= tetrade ? only : FANOUT;
+                          }
+                          static int level_prev_tetrade(const union ptr_s *slot, unsigned short level, int tetrade)
+                          {
+                              if(slot->next->level == level || is_empty(*slot))
+                                  return node_prev_tetrade(slot->next, tetrade);
+
+                              int only = tetradeValue(slot->next->prefix, level);
+                              return only <= tetrade ? only : -1;
+                          }
+                          static inline mapped_type *leaf_value(const node_s *leaf, tetrade_type tetrade)
+                          {
+                              if constexpr(INLINE_VALUES)
+                              {
+                                  const leaf_node_s *inline_leaf = static_cast<const leaf_node_s*>(leaf);
+                                  if(leaf == &empty_node || !inline_leaf->mask.test(tetrade))
+                                      return nullptr;
+                                  return leaf_slot(inline_leaf, tetrade);
+                              }
+                              else
+                              {
+                                  const union ptr_s *slot = node_child(leaf, tetrade);
+                                  return is_empty(*slot) ? nullptr : slot->val;
+                              }
+                          }
+                          /*
+                           * Descends without looking at the skipped tetrades, the prefix of the leaf reached at the end
+                           * holds every tetrade of its keys except the last one, so a single comparison there is enough.
+                           */
+                          inline union ptr_s element_fast_find(const radix_type key) const
+                          {
+                              unsigned char *key_bytes = (unsigned char*)&key;
+                              const node_s *node = root.next;
+                              unsigned int level = MAX_DEPTH - 1;
+                              while(node->level != 0)
+                              {
+                                  hooks.hop(level = node->level);
+                                  node = node_child(node, tetradeValue(key_bytes, node->level))->next;
+                              }
+
+                              union ptr_s result = empty_node.child[0];
+                              mapped_type *value = leaf_find(key_bytes, node);
+                              if(value != nullptr)
+                                  result.val = value;
+                              else if constexpr(STATS)
+                                  hooks.miss(node == &empty_node ? level : std::max(prefix_mismatch(key_bytes, node), 0));
+                              return result;
+                          }
+                          static inline mapped_type *leaf_find(const unsigned char *key_bytes, const node_s *leaf)
+                          {
+                              return prefix_matches(key_bytes, leaf) ? leaf_value(leaf, tetradeValue(key_bytes, 0)) : nullptr;
+                          }
+                          /*
+                           * Same descent as element_fast_find for up to FIND_BATCH keys at a time, taking one step of each
+                           * key in turn and prefetching what that step will need next time, so the cache misses of the
+                           * keys overlap. A step either picks the child slot of a node or loads the node behind a slot.
+                           * found(i, value) is called once for every key, in no particular order.
+                           */
+                          static constexpr unsigned int FIND_BATCH = 16;
+                          template<class F>
+                              void element_find_many(std::span<const key_type> keys, F &&found) const
+                              {
+                                  radix_type batch[FIND_BATCH];
+                                  const node_s *nodes[FIND_BATCH];
+                                  const union ptr_s *slots[FIND_BATCH];
+                                  unsigned char active[FIND_BATCH];
+
+                                  for(std::size_t base = 0; base < keys.size(); base += FIND_BATCH)
+                                  {
+                                      unsigned int remaining = keys.size() - base < FIND_BATCH ? keys.size() - base : FIND_BATCH;
+                                      for(unsigned int i = 0; i < remaining; i++)
+                                      {
+                                          batch[i] = Ordering::apply(keys[base + i]);
+                                          nodes[i] = root.next;
+                                          slots[i] = nullptr;
+                                          active[i] = i;
+                                      }
+
+                                      while(remaining > 0)
+                                      {
+                                          for(unsigned int j = 0; j < remaining;)
+                                          {
+                                              unsigned int i = active[j];
+                                              const unsigned char *key_bytes = (const unsigned char*)(batch + i);
+                                              if(slots[i] != nullptr)
+                                              {
+                                                  nodes[i] = slots[i]->next;
+                                                  slots[i] = nullptr;
+                                                  ARRAYMAP_PREFETCH(nodes[i]);
+                                                  j++;
+                                              }
+                                              else if(nodes[i]->level != 0)
+                                              {
+                                                  hooks.hop(nodes[i]->level);
+                                                  slots[i] = node_child(nodes[i], tetradeValue(key_bytes, nodes[i]->level));
+                                                  ARRAYMAP_PREFETCH(slots[i]);
+                                                  j++;
+                                              }
+                                              else
+                                              {
+                                                  found(base + i, leaf_find(key_bytes, nodes[i]));
+                                                  active[j] = active[--remaining];
+                                              }
+                                          }
+                                      }
+                                  }
+                              }
+                          /*
+                           * Single descent insert, the returned iterator's stack is filled on the way down.
+                           */
+                          template<class... Args>
+                              std::pair<iterator,bool> element_emplace(const radix_type key, Args&&... args)
+                              {
+                                  iterator it(this);
+                                  bool added = it.emplace_elem(key, MAX_DEPTH - 1, std::forward<Args>(args)...);
+                                  return std::make_pair(it, added);
+                              }
+                          /*
+                           * A hint pointing at an element of this map shares its path with key down to the highest level
+                           * where the two keys differ, so the descent starts there instead of at the root.
+                           */
+                          template<class... Args>
+                              iterator element_emplace_hint(const iterator_base &hint, const radix_type key, Args&&... args)
+                              {
+                                  iterator it(this);
+                                  short level = MAX_DEPTH - 1;
+                                  if(hint.map == this && hint.version == version && hint.depth == 0 && hint.key_bytes[sizeof(radix_type)] == 0)
+                                  {
+                                      radix_type hint_key;
+                                      std::memcpy(&hint_key, hint.key_bytes, sizeof(radix_type));
+                                      level = split_level(key, hint_key);
+                                      std::copy(hint.stack + level, hint.stack + MAX_DEPTH, it.stack + level);
+                                  }
+                                  it.emplace_elem(key, level, std::forward<Args>(args)...);
+                                  return it;
+                              }
+                          /*
+                           * Adds the path to a key that is not yet present below slot, which has to be on the key's path,
+                           * and returns uninitialized storage for its value.
+                           */
+                          mapped_type *element_fast_slot(const radix_type key)
+                          {
+                              return element_fast_slot((const unsigned char*)&key, &root);
+                          }
+                          mapped_type *element_fast_slot(const unsigned char *key_bytes, union ptr_s *current_Node)
+                          {
+                              if(is_empty(*current_Node))
+                                  current_Node->next = node_new(LEAF_KIND, 0, key_bytes);
+
+                              for(;;)
+                              {
+                                  node_s *node = current_Node->next;
+                                  hooks.hop(node->level);
+                                  int split = prefix_mismatch(key_bytes, node);
+                                  if(split >= 0)
+                                  {
+                                      current_Node->next = node_new(NODE_SMALL, split, key_bytes);
+                                      union ptr_s *moved = node_add_child(current_Node, tetradeValue(node->prefix, split));
+                                      moved->next = node;
+                                      if constexpr(COUNTED)
+                                          slot_count(current_Node->next, moved) = subtree_size(node);
+                                      version++;
+                                  }
+
+                                  tetrade_type tetrade = tetradeValue(key_bytes, current_Node->next->level);
+                                  if(current_Node->next->level == 0)
+                                  {
+                                      mapped_type *value = leaf_add(current_Node, tetrade);
+                                      if constexpr(COUNTED)
+                                          count_path(key_bytes, 1);
+                                      return value;
+                                  }
+
+                                  union ptr_s *child = node_child(current_Node->next, tetrade);
+                                  if(is_empty(*child))
+                                  {
+                                      child = node_add_child(current_Node, tetrade);
+                                      child->next = node_new(LEAF_KIND, 0, key_bytes);
+                                  }
+                                  current_Node = child;
+                              }
+                          }
+                          /*
+                           * Builds the node at level holding count sorted, unique keys and moves their values in.
+                           * The children are counted first so the node is created as the kind it ends up being.
+                           */
+                          node_s *bulk_node(const radix_type *keys, mapped_type *values, std::size_t count, unsigned short level)
+                          {
+                              node_kind kind = bulk_kind(bulk_children(keys, count, level), level);
+
+                              union ptr_s slot;
+                              slot.next = node_new(kind, level, (const unsigned char*)keys);
+                              for(std::size_t begin = 0, end; begin < count; begin = end)
+                              {
+                                  tetrade_type tetrade = tetradeValue((const unsigned char*)(keys + begin), level);
+                                  for(end = begin + 1; end < count && tetradeValue((const unsigned char*)(keys + end), level) == tetrade; end++);
+
+                                  if(level == 0)
+                                      std::construct_at(leaf_add(&slot, tetrade), std::move(values[begin]));
+                                  else
+                                  {
+                                      union ptr_s *child = node_add_child(&slot, tetrade);
+                                      child->next = bulk_node(keys + begin, values + begin, end - begin, split_level(keys[begin], keys[end - 1]));
+                                      if constexpr(COUNTED)
+                                          slot_count(slot.next, child) = end - begin;
+                                  }
+                              }
+                              return slot.next;
+                          }
+                          static unsigned int bulk_children(const radix_type *keys, std::size_t count, unsigned short level)
+                          {
+                              unsigned int children = 1;
+                              for(std::size_t i = 1; i < count; i++)
+                                  children += tetradeValue((const unsigned char*)(keys + i), level) != tetradeValue((const unsigned char*)(keys + i - 1), level);
+                              return children;
+                          }
+                          /*
+                           * Smallest kind that holds the children, which is also what inserting them one by one ends up with.
+                           */
+                          static node_kind bulk_kind(unsigned int children, unsigned short level)
+                          {
+                              if(level == 0 && INLINE_VALUES)
+                                  return NODE_LEAF;
+                              return children <= SMALL_NODE_SIZE ? NODE_SMALL : HAS_MEDIUM_NODE && children <= MEDIUM_NODE_SIZE ? NODE_MEDIUM : NODE_FULL;
+                          }
+                          /*
+                           * Highest level at which two keys differ, 0 for equal keys.
+                           */
+                          static unsigned short split_level(const radix_type &a, const radix_type &b)
+                          {
+                              const unsigned char *a_bytes = (const unsigned char*)&a, *b_bytes = (const unsigned char*)&b;
+                              for(int i = sizeof(radix_type) - 1; i >= 0; i--)
+                              {
+                                  unsigned char diff = a_bytes[i] ^ b_bytes[i];
+                                  if(diff != 0)
+                                      return ( i * 8 + 7 - std::countl_zero(diff) ) / RADIX_BITS;
+                              }
+                              return 0;
+                          }
+                          /*
+                           * Order of keys after Ordering::apply, which is the order of the tree.
+                           */
+                          static bool key_less(const radix_type &a, const radix_type &b)
+                          {
+                              if constexpr(std::endian::native == std::endian::little && sizeof(radix_type) <= sizeof(std::uint64_t))
+                              {
+                                  std::uint64_t a_value = 0, b_value = 0;
+                                  std::memcpy(&a_value, &a, sizeof(radix_type));
+                                  std::memcpy(&b_value, &b, sizeof(radix_type));
+                                  return a_value < b_value;
+                              }
+                              else
+                              {
+                                  const unsigned char *a_bytes = (const unsigned char*)&a, *b_bytes = (const unsigned char*)&b;
+                                  for(int i = sizeof(radix_type) - 1; i >= 0; i--)
+                                      if(a_bytes[i] != b_bytes[i]) return a_bytes[i] < b_bytes[i];
+                                  return false;
+                              }
+                          }
+                          mapped_type *leaf_add(union ptr_s *slot, tetrade_type tetrade)
+                          {
+                              if constexpr(INLINE_VALUES)
+                              {
+                                  leaf_node_s *leaf = static_cast<leaf_node_s*>(slot->next);
+                                  leaf->mask.set(tetrade);
+                                  leaf->count++;
+                                  return leaf_slot(leaf, tetrade);
+                              }
+                              else
+                                  return node_add_child(slot, tetrade)->val = alloc.allocate(1);
+                          }
+                          union ptr_s element_fast_add(const radix_type key)
+                          {
+                              union ptr_s result;
+                              result.val = element_fast_slot(key);
+                              std::construct_at(result.val);
+                              return result;
+                          }
+                          union ptr_s element_fast_add(const radix_type key, mapped_type value)
+                          {
+                              union ptr_s result;
+                              result.val = element_fast_slot(key);
+                              std::construct_at(result.val, std::move(value));
+                              return result;
+                          }
+                          template< class... Args >
+                              union ptr_s element_fast_add(const radix_type key,Args&&... args)
+                              {
+                                  union ptr_s result;
+                                  result.val = element_fast_slot(key);
+                                  std::construct_at(result.val, std::forward<Args>(args)...);
+                                  return result;
+                              }
+                          static inline tetrade_type tetradeValue(const unsigned char *bytes, unsigned int Nr)
+                          {
+                              if constexpr(RADIX_BITS == 4)
+                                  return ( bytes[Nr >> 1] >> ( (Nr & 1) << 2 ) ) & 0xF;
+                              else if constexpr(RADIX_BITS == 8)
+                                  return bytes[Nr];
+                              else
+                                  return bytes[Nr << 1] | ( bytes[(Nr << 1) + 1] << 8 );
+                          }
+                          static inline void setTetrade(unsigned char *bytes, unsigned int Nr, tetrade_type value)
+                          {
+                              if constexpr(RADIX_BITS == 4)
+                                  bytes[Nr >> 1] = ( bytes[Nr >> 1] & ~( 0xF << ( (Nr & 1) << 2 ) ) ) | ( value << ( (Nr & 1) << 2 ) );
+                              else if constexpr(RADIX_BITS == 8)
+                                  bytes[Nr] = value;
+                              else
+                              {
+                                  bytes[Nr << 1] = value & 0xFF;
+                                  bytes[(Nr << 1) + 1] = value >> 8;
+                              }
+                          }
+
+                      public:
+                          arraymap(void):
+                              arraymap(Allocator())
+                      {
+                      }
+                          explicit arraymap(const Allocator &allocator):
+                              alloc(allocator),
+                              pool(alloc),
+                              version(0),
+                              end_it(this),
+                              cend_it(this),
+                              rend_it(this),
+                              crend_it(this),
+                              element_count(0)
+                      {
+                          root.next = &empty_node;
+                      }
+                          arraymap(std::initializer_list<value_type> ilist, const Allocator &allocator = Allocator()):
+                              arraymap(allocator)
+                      {
+                          insert(ilist);
+                      }
+                          template<class InputIt>
+                              requires requires(InputIt it){ ++it; (*it).first; (*it).second; }
+                              arraymap(InputIt first, InputIt last, const Allocator &allocator = Allocator()):
+                                  arraymap(allocator)
+                      {
+                          bulk_load(first, last);
+                      }
+                          arraymap(const arraymap &other):
+                              arraymap(alloc_traits::select_on_container_copy_construction(other.alloc))
+                      {
+                          clone_from(other, 1);
+                      }
+                          arraymap(const arraymap &other, const Allocator &allocator):
+                              arraymap(allocator)
+                      {
+                          clone_from(other, 1);
+                      }
+                          arraymap(const arraymap &other, unsigned int threads):
+                              arraymap(alloc_traits::select_on_container_copy_construction(other.alloc))
+                      {
+                          clone_from(other, threads);
+                      }
+                          arraymap(arraymap &&other):
+                              arraymap(Allocator(other.alloc))
+                      {
+                          pool.swap(other.pool);
+                          root = other.root;
+                          element_count = other.element_count;
+                          other.root.next = &empty_node;
+                          other.element_count = 0;
+                          other.version++;
+                      }
+                          arraymap &operator=(const arraymap& other)
+                          {
+                              assign(other, 1);
+                              return *this;
+                          }
+                          /*
+                           * Nodes and values can only change hands along with the allocator they came from, a map with
+                           * a different one that stays behind gets the values moved into allocations of its own instead.
+                           */
+                          arraymap &operator=(arraymap&& other) noexcept(alloc_traits::propagate_on_container_move_assignment::value || alloc_traits::is_always_equal::value)
+                          {
+                              if(&other == this)
+                                  return *this;
+                              if constexpr(!alloc_traits::propagate_on_container_move_assignment::value && !alloc_traits::is_always_equal::value)
+                                  if(alloc != other.alloc)
+                                  {
+                                      clear();
+                                      move_elements(other);
+                                      return *this;
+                                  }
+                              clear();
+                              if constexpr(alloc_traits::propagate_on_container_move_assignment::value)
+                              {
+                                  alloc = std::move(other.alloc);
+                                  pool.reset(alloc);
+                              }
+                              pool.swap(other.pool);
+                              root = other.root;
+                              element_count = other.element_count;
+                              other.root.next = &empty_node;
+                              other.element_count = 0;
+                              other.version++;
+                              return *this;
+                          }
+                          arraymap &operator=(std::initializer_list<value_type> ilist) noexcept
+                          {
+                              clear();
                               insert(ilist);
                               return *this;
                           }
                           ~arraymap(void)
                           {
-                              free_node_tree(&root, MAX_DEPTH);
+                              free_values(&root);
                           }
                   };
+    /*
+     * Set algebra on the keys of two maps, walking both trees side by side. Subtrees only one side has are copied
+     * whole or skipped without a lookup in the other. Values are taken from a, from b for keys only b has.
+     */
+    template<class _Key, class _Tp, class Ordering, class Allocator, unsigned char RadixBits, class Stats, bool Counted>
+        arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> set_intersection(const arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> &a, const arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> &b)
+        {
+            typedef arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> map_type;
+            return map_type::combined(a, b, map_type::COMBINE_INTERSECTION);
+        }
+    template<class _Key, class _Tp, class Ordering, class Allocator, unsigned char RadixBits, class Stats, bool Counted>
+        arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> set_union(const arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> &a, const arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> &b)
+        {
+            typedef arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> map_type;
+            return map_type::combined(a, b, map_type::COMBINE_UNION);
+        }
+    template<class _Key, class _Tp, class Ordering, class Allocator, unsigned char RadixBits, class Stats, bool Counted>
+        arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> set_difference(const arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> &a, const arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> &b)
+        {
+            typedef arraymap<_Key, _Tp, Ordering, Allocator, RadixBits, Stats, Counted> map_type;
+            return map_type::combined(a, b, map_type::COMBINE_DIFFERENCE);
+        }
+    /*
+     * An arraymap that any number of threads can look up in without locking while writers take turns on a mutex.
+     *
+     * Writers never change a node that readers can reach. They change a private copy and publish it with a release store
+     * into the slot pointing at the original, which gets retired. Readers announce themselves in counters kept per epoch
+     * (spread over cache line sized shards to keep them from contending), and whatever was retired is reclaimed once
+     * no reader of the epoch it was retired in is left.
+     *
+     * Lookups hand out copies of the values, as an element can be erased by a writer as soon as the lookup is done.
+     *
+     * snapshot() pins the tree as it is at that moment. While any snapshot is open writers copy the whole path from
+     * the root down instead of storing into nodes in place, and nothing retired is reclaimed until it is closed.
+     */
+    template<class _Key, class _Tp, class Ordering = ordering_default<_Key>, class Allocator = std::allocator<_Tp>, unsigned char RadixBits = 4>
+        class concurrent_arraymap{
+            public:
+                typedef arraymap<_Key, _Tp, Ordering, Allocator, RadixBits> map_type;
+                typedef typename map_type::key_type key_type;
+                typedef typename map_type::radix_type radix_type;
+                typedef typename map_type::mapped_type mapped_type;
+                typedef typename map_type::value_type value_type;
+                typedef typename map_type::size_type size_type;
+
+                class snapshot_view;
+
+                concurrent_arraymap():
+                    epoch(0),
+                    element_count(0),
+                    snapshots(0)
+            {
+                for(reader_count_s &shard : readers)
+                    shard.count[0] = shard.count[1] = 0;
+            }
+                concurrent_arraymap(const concurrent_arraymap &) = delete;
+                concurrent_arraymap &operator=(const concurrent_arraymap &) = delete;
+                ~concurrent_arraymap()
+                {
+                    for(unsigned int parity = 0; parity < 2; parity++)
+                        for(mapped_type *value : retired_values[parity])
+                            free_value(value);
+                }
+
+                bool contains(const key_type &key) const
+                {
+                    return visit(key, [](const mapped_type &){});
+                }
+                std::optional<mapped_type> find(const key_type &key) const
+                {
+                    std::optional<mapped_type> result;
+                    visit(key, [&](const mapped_type &value){ result.emplace(value); });
+                    return result;
+                }
+                mapped_type at(const key_type &key) const
+                {
+                    std::optional<mapped_type> result = find(key);
+                    if(!result)
+                        throw std::out_of_range("concurrent_arraymap::at");
+                    return *result;
+                }
+                /*
+                 * Calls f with the value of key, if there is one, while it is still guaranteed to be alive.
+                 */
+                template<class F>
+                    bool visit(const key_type &key, F &&f) const
+                    {
+                        read_section section(*this);
+                        const mapped_type *value = lookup(load(map.root), key);
+                        if(value != nullptr)
+                            f(*value);
+                        return value != nullptr;
+                    }
+                /*
+                 * An immutable view of the map at the time it was taken, costing nothing to take but keeping every
+                 * node and value the writers replace from then on alive until it is destroyed. It must not outlive
+                 * the map.
+                 */
+                snapshot_view snapshot() const
+                {
+                    std::lock_guard<std::mutex> lock(writer);
+                    snapshots.fetch_add(1);
+                    return snapshot_view(*this, map.root.next, map.element_count);
+                }
+                size_type size() const
+                {
+                    return element_count.load(std::memory_order_relaxed);
+                }
+                bool empty() const
+                {
+                    return size() == 0;
+                }
+
+                bool insert(const value_type &value)
+                {
+                    return try_emplace(value.first, value.second);
+                }
+                template<class... Args>
+                    bool try_emplace(const key_type &key, Args&&... args)
+                    {
+                        std::lock_guard<std::mutex> lock(writer);
+                        radix_type applied = Ordering::apply(key);
+                        if(!map_type::is_empty(map.element_fast_find(applied)))
+                            return false;
+
+                        add((const unsigned char*)&applied, std::forward<Args>(args)...);
+                        added();
+                        return true;
+                    }
+                template<class M>
+                    bool insert_or_assign(const key_type &key, M &&value)
+                    {
+                        std::lock_guard<std::mutex> lock(writer);
+                        radix_type applied = Ordering::apply(key);
+                        const unsigned char *key_bytes = (const unsigned char*)&applied;
+                        if(map_type::is_empty(map.element_fast_find(applied)))
+                        {
+                            add(key_bytes, std::forward<M>(value));
+                            added();
+                            return true;
+                        }
+
+                        ptr_s *path[MAX_DEPTH];
+                        int depth = 0;
+                        for(path[0] = &map.root; path[depth]->next->level != 0; depth++)
+                            path[depth + 1] = map_type::node_child(path[depth]->next, map_type::tetradeValue(key_bytes, path[depth]->next->level));
+
+                        node_s *leaf = path[depth]->next;
+                        node_s *copy = map.node_copy(leaf);
+                        tetrade_type tetrade = map_type::tetradeValue(key_bytes, 0);
+                        if constexpr(map_type::INLINE_VALUES)
+                            *map_type::leaf_value(copy, tetrade) = std::forward<M>(value);
+                        else
+                        {
+                            ptr_s *value_slot = map_type::node_child(copy, tetrade);
+                            retired_values[epoch.load(std::memory_order_relaxed) & 1].push_back(value_slot->val);
+                            value_slot->val = new_value(std::forward<M>(value));
+                        }
+                        commit(path, depth, copy);
+                        retire(leaf);
+                        reclaim();
+                        return false;
+                    }
+                size_type erase(const key_type &key)
+                {
+                    std::lock_guard<std::mutex> lock(writer);
+                    radix_type applied = Ordering::apply(key);
+                    const unsigned char *key_bytes = (const unsigned char*)&applied;
+                    ptr_s found = map.element_fast_find(applied);
+                    if(map_type::is_empty(found))
+                        return 0;
+                    if constexpr(!map_type::INLINE_VALUES)
+                        retired_values[epoch.load(std::memory_order_relaxed) & 1].push_back(found.val);
+
+                    ptr_s *path[MAX_DEPTH];
+                    int depth = 0;
+                    for(ptr_s *slot = &map.root;; slot = map_type::node_child(slot->next, map_type::tetradeValue(key_bytes, slot->next->level)))
+                    {
+                        path[depth++] = slot;
+                        if(slot->next->level == 0) break;
+                    }
+                    remove(path, depth - 1, key_bytes);
+
+                    map.element_count--;
+                    element_count.fetch_sub(1, std::memory_order_relaxed);
+                    reclaim();
+                    return 1;
+                }
+                /*
+                 * Empties the map, waiting for the readers that might still see its elements to leave.
+                 */
+                void clear()
+                {
+                    std::lock_guard<std::mutex> lock(writer);
+                    ptr_s old_root = map.root;
+                    publish(&map.root, &map_type::empty_node);
+                    if(snapshots.load() != 0)
+                    {
+                        if(!map_type::is_empty(old_root))
+                            retire_tree(old_root.next);
+                        reclaim();
+                    }
+                    else
+                    {
+                        synchronize();
+                        map.free_values(&old_root);
+                        map.pool.release();
+                    }
+                    map.element_count = 0;
+                    map.version++;
+                    element_count.store(0, std::memory_order_relaxed);
+                }
+
+            private:
+                typedef typename map_type::node_s node_s;
+                typedef typename map_type::ptr_s ptr_s;
+                typedef typename map_type::tetrade_type tetrade_type;
+                static constexpr unsigned short MAX_DEPTH = map_type::MAX_DEPTH;
+                static constexpr unsigned int READER_SHARDS = 16;
+
+                struct alignas(64) reader_count_s{
+                    std::atomic<std::size_t> count[2];
+                };
+                /*
+                 * Announces a reader in the counter of the current epoch. An epoch that changed between reading it
+                 * and counting in it may already have been waited out, so the reader retries with the new one.
+                 */
+                class read_section{
+                    public:
+                        read_section(const concurrent_arraymap &owner):
+                            counts(owner.readers[reader_shard()].count),
+                            parity(enter(owner, counts))
+                    {
+                    }
+                        ~read_section()
+                        {
+                            counts[parity].fetch_sub(1, std::memory_order_release);
+                        }
+                    private:
+                        std::atomic<std::size_t> *counts;
+                        unsigned int parity;
+                };
+
+                map_type map;
+                mutable std::mutex writer;
+                std::atomic<std::uint64_t> epoch;
+                std::atomic<size_type> element_count;
+                mutable std::atomic<unsigned int> snapshots;
+                mutable reader_count_s readers[READER_SHARDS];
+                std::vector<node_s*> retired_nodes[2];
+                std::vector<mapped_type*> retired_values[2];
+
+                static unsigned int reader_shard()
+                {
+                    static std::atomic<unsigned int> next_shard(0);
+                    thread_local unsigned int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % READER_SHARDS;
+                    return shard;
+                }
+                static unsigned int enter(const concurrent_arraymap &owner, std::atomic<std::size_t> *counts)
+                {
+                    for(;;)
+                    {
+                        std::uint64_t current = owner.epoch.load();
+                        unsigned int parity = current & 1;
+                        counts[parity].fetch_add(1);
+                        if(owner.epoch.load() == current) return parity;
+                        counts[parity].fetch_sub(1, std::memory_order_release);
+                    }
+                }
+                static const mapped_type *lookup(const node_s *node, const key_type &key)
+                {
+                    radix_type applied = Ordering::apply(key);
+                    const unsigned char *key_bytes = (const unsigned char*)&applied;
+                    while(node->level != 0)
+                        node = load(*map_type::node_child(node, map_type::tetradeValue(key_bytes, node->level)));
+                    return map_type::leaf_find(key_bytes, node);
+                }
+                static node_s *load(const ptr_s &slot)
+                {
+                    return std::atomic_ref<node_s*>(const_cast<node_s*&>(slot.next)).load(std::memory_order_acquire);
+                }
+                static void publish(ptr_s *slot, node_s *node)
+                {
+                    std::atomic_ref<node_s*>(slot->next).store(node, std::memory_order_release);
+                }
+                void retire(node_s *node)
+                {
+                    retired_nodes[epoch.load(std::memory_order_relaxed) & 1].push_back(node);
+                }
+                void retire_tree(node_s *node)
+                {
+                    if(!map_type::INLINE_VALUES || node->level != 0)
+                        for(int tetrade = map_type::node_next_tetrade(node, 0); tetrade < (int)map_type::FANOUT; tetrade = map_type::node_next_tetrade(node, tetrade + 1))
+                        {
+                            ptr_s *child = map_type::node_child(node, tetrade);
+                            if(node->level == 0)
+                                retired_values[epoch.load(std::memory_order_relaxed) & 1].push_back(child->val);
+                            else
+                                retire_tree(child->next);
+                        }
+                    retire(node);
+                }
+                /*
+                 * Stores node into the slot at path[level], path[0] being the root. While snapshots are open the
+                 * nodes above it are copied as well, up to the root, since the snapshots still see the originals.
+                 */
+                void commit(ptr_s **path, int level, node_s *node)
+                {
+                    if(snapshots.load() != 0)
+                        for(; level > 0; level--)
+                        {
+                            node_s *parent = path[level - 1]->next;
+                            node_s *copy = map.node_copy(parent);
+                            ((ptr_s*)((unsigned char*)copy + ((unsigned char*)path[level] - (unsigned char*)parent)))->next = node;
+                            retire(parent);
+                            node = copy;
+                        }
+                    publish(path[level], node);
+                }
+                template<class... Args>
+                    mapped_type *new_value(Args&&... args)
+                    {
+                        mapped_type *value = map.alloc.allocate(1);
+                        std::construct_at(value, std::forward<Args>(args)...);
+                        return value;
+                    }
+                void free_value(mapped_type *value)
+                {
+                    std::destroy_at(value);
+                    map.alloc.deallocate(value, 1);
+                }
+                void added()
+                {
+                    map.element_count++;
+                    element_count.fetch_add(1, std::memory_order_relaxed);
+                    reclaim();
+                }
+                /*
+                 * Moves on to the next epoch if no reader of the previous one is left, the nodes and values retired back
+                 * then cannot be seen by anyone anymore and are freed. Their counters are reused by the next epoch.
+                 */
+                bool reclaim()
+                {
+                    std::uint64_t current = epoch.load(std::memory_order_relaxed);
+                    unsigned int previous = (current + 1) & 1;
+                    for(reader_count_s &shard : readers)
+                        if(shard.count[previous].load() != 0) return false;
+
+                    for(node_s *node : retired_nodes[previous])
+                        map.node_free(node);
+                    for(mapped_type *value : retired_values[previous])
+                        free_value(value);
+                    retired_nodes[previous].clear();
+                    retired_values[previous].clear();
+                    epoch.store(current + 1);
+                    return true;
+                }
+                /*
+                 * Two epoch changes in a row outlast every reader that was there when it was called.
+                 */
+                void synchronize()
+                {
+                    for(int i = 0; i < 2; i++)
+                        while(!reclaim())
+                            std::this_thread::yield();
+                }
+                template<class... Args>
+                    node_s *new_leaf(const unsigned char *key_bytes, Args&&... args)
+                    {
+                        ptr_s leaf;
+                        leaf.next = map.node_new(map_type::LEAF_KIND, 0, key_bytes);
+                        std::construct_at(map.leaf_add(&leaf, map_type::tetradeValue(key_bytes, 0)), std::forward<Args>(args)...);
+                        return leaf.next;
+                    }
+                /*
+                 * Same descent as element_fast_slot, the one node that changes is copied and the nodes added below it
+                 * are built completely before anything is published.
+                 */
+                template<class... Args>
+                    void add(const unsigned char *key_bytes, Args&&... args)
+                    {
+                        ptr_s *slot = &map.root;
+                        if(map_type::is_empty(*slot))
+                        {
+                            publish(slot, new_leaf(key_bytes, std::forward<Args>(args)...));
+                            return;
+                        }
+
+                        ptr_s *path[MAX_DEPTH];
+                        for(int depth = 0;; depth++)
+                        {
+                            path[depth] = slot;
+                            node_s *node = slot->next;
+                            int split = map_type::prefix_mismatch(key_bytes, node);
+                            if(split >= 0)
+                            {
+                                ptr_s branch;
+                                branch.next = map.node_new(map_type::NODE_SMALL, split, key_bytes);
+                                map.node_add_child(&branch, map_type::tetradeValue(node->prefix, split))->next = node;
+                                map.node_add_child(&branch, map_type::tetradeValue(key_bytes, split))->next = new_leaf(key_bytes, std::forward<Args>(args)...);
+                                commit(path, depth, branch.next);
+                                return;
+                            }
+
+                            tetrade_type tetrade = map_type::tetradeValue(key_bytes, node->level);
+                            if(node->level != 0 && !map_type::is_empty(*map_type::node_child(node, tetrade)))
+                            {
+                                slot = map_type::node_child(node, tetrade);
+                                continue;
+                            }
+
+                            ptr_s copy;
+                            copy.next = map.node_copy(node);
+                            if(node->level == 0)
+                                std::construct_at(map.leaf_add(&copy, tetrade), std::forward<Args>(args)...);
+                            else
+                                map.node_add_child(&copy, tetrade)->next = new_leaf(key_bytes, std::forward<Args>(args)...);
+                            commit(path, depth, copy.next);
+                            retire(node);
+                            return;
+                        }
+                    }
+                /*
+                 * Removes key's child from the node behind path[level], the nodes above it are behind the earlier
+                 * entries. Emptied nodes have their own entry removed from their parent in turn, a node left with a
+                 * single child is replaced by that child.
+                 */
+                void remove(ptr_s **path, int level, const unsigned char *key_bytes)
+                {
+                    for(;; level--)
+                    {
+                        ptr_s *slot = path[level];
+                        node_s *node = slot->next;
+                        tetrade_type tetrade = map_type::tetradeValue(key_bytes, node->level);
+                        if(node->count == 1)
+                        {
+                            retire(node);
+                            if(level > 0) continue;
+                            commit(path, level, &map_type::empty_node);
+                            return;
+                        }
+
+                        if(node->count == 2 && node->level != 0)
+                        {
+                            int other = map_type::node_next_tetrade(node, 0);
+                            if(other == tetrade)
+                                other = map_type::node_next_tetrade(node, tetrade + 1);
+                            commit(path, level, map_type::node_child(node, other)->next);
+                        }
+                        else
+                        {
+                            ptr_s copy;
+                            copy.next = map.node_copy(node);
+                            map.node_remove_child(&copy, tetrade, false);
+                            commit(path, level, copy.next);
+                        }
+                        retire(node);
+                        return;
+                    }
+                }
+
+            public:
+                class snapshot_view{
+                    public:
+                        snapshot_view(snapshot_view &&other) noexcept:
+                            owner(std::exchange(other.owner, nullptr)),
+                            counts(other.counts),
+                            parity(other.parity),
+                            root(other.root),
+                            count(other.count)
+                    {
+                    }
+                        snapshot_view &operator=(snapshot_view &&other) noexcept
+                        {
+                            if(&other != this)
+                            {
+                                close();
+                                owner = std::exchange(other.owner, nullptr);
+                                counts = other.counts;
+                                parity = other.parity;
+                                root = other.root;
+                                count = other.count;
+                            }
+                            return *this;
+                        }
+                        ~snapshot_view()
+                        {
+                            close();
+                        }
+
+                        bool contains(const key_type &key) const
+                        {
+                            return lookup(root, key) != nullptr;
+                        }
+                        std::optional<mapped_type> find(const key_type &key) const
+                        {
+                            const mapped_type *value = lookup(root, key);
+                            if(value == nullptr)
+                                return std::nullopt;
+                            return *value;
+                        }
+                        const mapped_type &at(const key_type &key) const
+                        {
+                            const mapped_type *value = lookup(root, key);
+                            if(value == nullptr)
+                                throw std::out_of_range("concurrent_arraymap::snapshot_view::at");
+                            return *value;
+                        }
+                        size_type size() const
+                        {
+                            return count;
+                        }
+                        bool empty() const
+                        {
+                            return count == 0;
+                        }
+                        /*
+                         * Calls f(key, value) for every element in key order.
+                         */
+                        template<class F>
+                            void for_each(F &&f) const
+                            {
+                                if(count != 0)
+                                    walk(root, f);
+                            }
+
+                    private:
+                        friend class concurrent_arraymap;
+                        const concurrent_arraymap *owner;
+                        std::atomic<std::size_t> *counts;
+                        unsigned int parity;
+                        const node_s *root;
+                        size_type count;
+
+                        snapshot_view(const concurrent_arraymap &map, const node_s *root, size_type count):
+                            owner(&map),
+                            counts(map.readers[reader_shard()].count),
+                            parity(enter(map, counts)),
+                            root(root),
+                            count(count)
+                    {
+                    }
+                        void close()
+                        {
+                            if(owner == nullptr) return;
+                            counts[parity].fetch_sub(1, std::memory_order_release);
+                            owner->snapshots.fetch_sub(1);
+                            owner = nullptr;
+                        }
+                        template<class F>
+                            static void walk(const node_s *node, F &f)
+                            {
+                                for(int tetrade = map_type::node_next_tetrade(node, 0); tetrade < (int)map_type::FANOUT; tetrade = map_type::node_next_tetrade(node, tetrade + 1))
+                                {
+                                    if(node->level != 0)
+                                    {
+                                        walk(map_type::node_child(node, tetrade)->next, f);
+                                        continue;
+                                    }
+                                    unsigned char key_bytes[sizeof(radix_type)];
+                                    std::memcpy(key_bytes, node->prefix, sizeof(radix_type));
+                                    map_type::setTetrade(key_bytes, 0, tetrade);
+                                    radix_type key;
+                                    std::memcpy(&key, key_bytes, sizeof(radix_type));
+                                    f(Ordering::restore(key), (const mapped_type&)*map_type::leaf_value(node, tetrade));
+                                }
+                            }
+                };
+        };
+    /*
+     * A set of independent arraymaps, each owning the keys that start with one combination of the top ShardDigits
+     * tetrades and guarded by a lock of its own, so writers to different shards never wait for each other.
+     * Shards are in key order, so walking them one after another visits the elements in order.
+     */
+    template<class _Key, class _Tp, class Ordering = ordering_default<_Key>, class Allocator = std::allocator<_Tp>, unsigned char RadixBits = 4, unsigned char ShardDigits = 1>
+        class sharded_arraymap{
+            public:
+                typedef arraymap<_Key, _Tp, Ordering, Allocator, RadixBits> map_type;
+                typedef typename map_type::key_type key_type;
+                typedef typename map_type::radix_type radix_type;
+                typedef typename map_type::mapped_type mapped_type;
+                typedef typename map_type::value_type value_type;
+                typedef typename map_type::size_type size_type;
+
+                static_assert(ShardDigits >= 1 && ShardDigits * RadixBits <= 8 && ShardDigits <= map_type::MAX_DEPTH, "Sharded arraymap supports up to 8 bits worth of shard digits (256 shards)!");
+                static constexpr unsigned int SHARDS = 1u << (ShardDigits * RadixBits);
+
+                sharded_arraymap():
+                    shards(new shard_s[SHARDS])
+            {
+            }
+                sharded_arraymap(const sharded_arraymap &) = delete;
+                sharded_arraymap &operator=(const sharded_arraymap &) = delete;
+
+                bool contains(const key_type &key) const
+                {
+                    const shard_s &shard = shard_of(key);
+                    std::lock_guard<std::mutex> lock(shard.lock);
+                    return shard.map.contains(key);
+                }
+                std::optional<mapped_type> find(const key_type &key) const
+                {
+                    const shard_s &shard = shard_of(key);
+                    std::lock_guard<std::mutex> lock(shard.lock);
+                    auto it = shard.map.find(key);
+                    if(it == shard.map.cend())
+                        return std::nullopt;
+                    return std::optional<mapped_type>((*it).second.get());
+                }
+                mapped_type at(const key_type &key) const
+                {
+                    const shard_s &shard = shard_of(key);
+                    std::lock_guard<std::mutex> lock(shard.lock);
+                    return shard.map.at(key);
+                }
+                bool insert(const value_type &value)
+                {
+                    shard_s &shard = shard_of(value.first);
+                    std::lock_guard<std::mutex> lock(shard.lock);
+                    return shard.map.insert(value).second;
+                }
+                template<class... Args>
+                    bool try_emplace(const key_type &key, Args&&... args)
+                    {
+                        shard_s &shard = shard_of(key);
+                        std::lock_guard<std::mutex> lock(shard.lock);
+                        return shard.map.try_emplace(key, std::forward<Args>(args)...).second;
+                    }
+                template<class M>
+                    bool insert_or_assign(const key_type &key, M &&value)
+                    {
+                        shard_s &shard = shard_of(key);
+                        std::lock_guard<std::mutex> lock(shard.lock);
+                        auto result = shard.map.try_emplace(key, std::forward<M>(value));
+                        if(!result.second)
+                            (*result.first).second.get() = std::forward<M>(value);
+                        return result.second;
+                    }
+                size_type erase(const key_type &key)
+                {
+                    shard_s &shard = shard_of(key);
+                    std::lock_guard<std::mutex> lock(shard.lock);
+                    return shard.map.erase(key);
+                }
+                /*
+                 * Inserts a batch, bucketed by shard first and then applied by up to threads threads, each of which
+                 * takes the lock of a shard once for all of its elements. Returns how many were added.
+                 */
+                size_type insert_many(std::span<const value_type> values, unsigned int threads = std::thread::hardware_concurrency())
+                {
+                    std::vector<std::size_t> start(SHARDS + 1, 0), order(values.size());
+                    for(const value_type &value : values)
+                        start[shard_index(value.first) + 1]++;
+                    for(unsigned int i = 0; i < SHARDS; i++)
+                        start[i + 1] += start[i];
+                    std::vector<std::size_t> next(start.begin(), start.end() - 1);
+                    for(std::size_t i = 0; i < values.size(); i++)
+                        order[next[shard_index(values[i].first)]++] = i;
+
+                    std::atomic<unsigned int> next_shard(0);
+                    std::atomic<size_type> added(0);
+                    auto work = [&]()
+                    {
+                        for(unsigned int i; (i = next_shard.fetch_add(1, std::memory_order_relaxed)) < SHARDS;)
+                        {
+                            if(start[i] == start[i + 1]) continue;
+                            std::lock_guard<std::mutex> lock(shards[i].lock);
+                            size_type before = shards[i].map.size();
+                            for(std::size_t j = start[i]; j < start[i + 1]; j++)
+                                shards[i].map.insert(values[order[j]]);
+                            added.fetch_add(shards[i].map.size() - before, std::memory_order_relaxed);
+                        }
+                    };
+
+                    std::vector<std::thread> workers;
+                    for(unsigned int i = 1; i < threads && i < SHARDS; i++)
+                        workers.emplace_back(work);
+                    work();
+                    for(std::thread &worker : workers)
+                        worker.join();
+                    return added.load();
+                }
+                size_type size() const
+                {
+                    size_type count = 0;
+                    for(unsigned int i = 0; i < SHARDS; i++)
+                    {
+                        std::lock_guard<std::mutex> lock(shards[i].lock);
+                        count += shards[i].map.size();
+                    }
+                    return count;
+                }
+                bool empty() const
+                {
+                    return size() == 0;
+                }
+                void clear()
+                {
+                    for(unsigned int i = 0; i < SHARDS; i++)
+                    {
+                        std::lock_guard<std::mutex> lock(shards[i].lock);
+                        shards[i].map.clear();
+                    }
+                }
+                /*
+                 * Calls f(key, value) for every element in key order, holding one shard's lock at a time.
+                 */
+                template<class F>
+                    void for_each(F &&f)
+                    {
+                        for(unsigned int i = 0; i < SHARDS; i++)
+                        {
+                            std::lock_guard<std::mutex> lock(shards[i].lock);
+                            for(auto it = shards[i].map.begin(); it != shards[i].map.end(); ++it)
+                                f((*it).first, (*it).second.get());
+                        }
+                    }
+
+            private:
+                struct alignas(64) shard_s{
+                    mutable std::mutex lock;
+                    map_type map;
+                };
+
+                std::unique_ptr<shard_s[]> shards;
+
+                static unsigned int shard_index(const key_type &key)
+                {
+                    radix_type applied = Ordering::apply(key);
+                    unsigned int index = 0;
+                    for(unsigned int digit = 0; digit < ShardDigits; digit++)
+                        index = (index << RadixBits) | map_type::tetradeValue((const unsigned char*)&applied, map_type::MAX_DEPTH - 1 - digit);
+                    return index;
+                }
+                shard_s &shard_of(const key_type &key)
+                {
+                    return shards[shard_index(key)];
+                }
+                const shard_s &shard_of(const key_type &key) const
+                {
+                    return shards[shard_index(key)];
+                }
+        };
+    /*
+     * An ordered set of keys on the arraymap trie. Its elements map to an empty type, so the leaves hold nothing but
+     * their occupancy bitmap. Levels are 8 bits wide, every leaf is the 256-bit bitmap of the last byte of its keys
+     * and dense stretches of keys cost a bit each, contains() is one descent and a bit test.
+     */
+    template<class _Key, class Ordering = ordering_default<_Key>, class Allocator = std::allocator<_Key>>
+        class arrayset{
+            private:
+                struct member_s{};
+                typedef arraymap<_Key, member_s, Ordering, typename std::allocator_traits<Allocator>::template rebind_alloc<member_s>, 8> map_type;
+
+            public:
+                typedef _Key key_type;
+                typedef _Key value_type;
+                typedef Ordering ordering_elem;
+                typedef typename map_type::size_type size_type;
+                typedef Allocator allocator_type;
+                typedef typename map_type::memory_stats_type memory_stats_type;
+
+                class iterator{
+                    public:
+                        typedef std::bidirectional_iterator_tag iterator_category;
+                        typedef key_type value_type;
+                        typedef std::ptrdiff_t difference_type;
+                        typedef const key_type *pointer;
+                        typedef const key_type &reference;
+
+                        const key_type &operator*() const
+                        {
+                            return it->first;
+                        }
+                        const key_type *operator->() const
+                        {
+                            return &it->first;
+                        }
+                        iterator &operator++()
+                        {
+                            ++it;
+                            return *this;
+                        }
+                        iterator operator++(int)
+                        {
+                            iterator tmp(*this);
+                            ++it;
+                            return tmp;
+                        }
+                        iterator &operator--()
+                        {
+                            --it;
+                            return *this;
+                        }
+                        iterator operator--(int)
+                        {
+                            iterator tmp(*this);
+                            --it;
+                            return tmp;
+                        }
+                        bool operator==(const iterator &other) const
+                        {
+                            return it == other.it;
+                        }
+                        bool operator!=(const iterator &other) const
+                        {
+                            return it != other.it;
+                        }
+
+                    private:
+                        friend class arrayset;
+                        mutable typename map_type::iterator it;
+
+                        iterator(const typename map_type::iterator &position):
+                            it(position)
+                    {
+                    }
+                };
+                typedef iterator const_iterator;
+
+                arrayset()
+                {
+                }
+                explicit arrayset(const Allocator &allocator):
+                    map(typename map_type::allocator_type(allocator))
+                {
+                }
+                arrayset(std::initializer_list<key_type> ilist, const Allocator &allocator = Allocator()):
+                    arrayset(allocator)
+                {
+                    insert(ilist.begin(), ilist.end());
+                }
+                template<class InputIt>
+                    arrayset(InputIt first, InputIt last, const Allocator &allocator = Allocator()):
+                        arrayset(allocator)
+                    {
+                        insert(first, last);
+                    }
+                allocator_type get_allocator() const noexcept
+                {
+                    return allocator_type(map.get_allocator());
+                }
+
+                std::pair<iterator, bool> insert(const key_type &key)
+                {
+                    auto [position, added] = map.try_emplace(key);
+                    return std::make_pair(iterator(position), added);
+                }
+                iterator insert(const iterator &hint, const key_type &key)
+                {
+                    return iterator(map.try_emplace(hint.it, key));
+                }
+                template<class InputIt>
+                    void insert(InputIt first, InputIt last)
+                    {
+                        for(; first != last; ++first)
+                            map.try_emplace(*first);
+                    }
+                void insert(std::initializer_list<key_type> ilist)
+                {
+                    insert(ilist.begin(), ilist.end());
+                }
+                std::pair<iterator, bool> emplace(const key_type &key)
+                {
+                    return insert(key);
+                }
+                size_type erase(const key_type &key)
+                {
+                    return map.erase(key);
+                }
+                iterator erase(const iterator &position)
+                {
+                    return iterator(map.erase(position.it));
+                }
+                void erase(const iterator &first, const iterator &last)
+                {
+                    map.erase(first.it, last.it);
+                }
+                size_type erase_range(const key_type &lo, const key_type &hi)
+                {
+                    return map.erase_range(lo, hi);
+                }
+                bool contains(const key_type &key) const
+                {
+                    return map.contains(key);
+                }
+                size_type count(const key_type &key) const
+                {
+                    return map.contains(key);
+                }
+                iterator find(const key_type &key) const
+                {
+                    return iterator(map.find(key));
+                }
+                iterator lower_bound(const key_type &key) const
+                {
+                    return iterator(map.lower_bound(key));
+                }
+                iterator upper_bound(const key_type &key) const
+                {
+                    return iterator(map.upper_bound(key));
+                }
+                iterator begin() const
+                {
+                    return iterator(map.begin());
+                }
+                iterator end() const
+                {
+                    return iterator(map.end());
+                }
+                iterator cbegin() const
+                {
+                    return begin();
+                }
+                iterator cend() const
+                {
+                    return end();
+                }
+                size_type size() const noexcept
+                {
+                    return map.size();
+                }
+                bool empty() const noexcept
+                {
+                    return map.empty();
+                }
+                void clear() noexcept
+                {
+                    map.clear();
+                }
+                void compact()
+                {
+                    map.compact();
+                }
+                void shrink_to_fit()
+                {
+                    map.compact();
+                }
+                void swap(arrayset &other)
+                {
+                    std::swap(map, other.map);
+                }
+                memory_stats_type memory_stats() const
+                {
+                    return map.memory_stats();
+                }
+                bool operator==(const arrayset &other) const
+                {
+                    return size() == other.size() && std::equal(begin(), end(), other.begin());
+                }
+
+            private:
+                /*
+                 * The map's iterators are handed out by const members as well, nothing can be changed through them
+                 * as there are no values.
+                 */
+                mutable map_type map;
+        };
+    /*
+     * The containers with values and nodes taken from a std::pmr::memory_resource, so per-request maps can live in a
+     * monotonic or pooled arena that is dropped in one go.
+     */
+    namespace pmr{
+        template<class _Key, class _Tp, class Ordering = ordering_default<_Key>, unsigned char RadixBits = 4, class Stats = stats_none, bool Counted = false>
+            using arraymap = ::arraymap::arraymap<_Key, _Tp, Ordering, std::pmr::polymorphic_allocator<_Tp>, RadixBits, Stats, Counted>;
+        template<class _Key, class Ordering = ordering_default<_Key>>
+            using arrayset = ::arraymap::arrayset<_Key, Ordering, std::pmr::polymorphic_allocator<_Key>>;
+    }
+#ifdef ARRAYMAP_MMAP
+    /*
+     * A read-only arraymap over an image written by arraymap::save. The file is mapped into memory rather than loaded,
+     * so opening takes no time however big it is and the page cache shares it between processes. Lookups and iteration
+     * work on the saved nodes in place, following offsets into the image where the map follows pointers.
+     * Counted has to match that of the saved map, whose nodes it lays out.
+     */
+    template<class _Key, class _Tp, class Ordering = ordering_default<_Key>, unsigned char RadixBits = 4, bool Counted = false>
+        class mapped_arraymap{
+            public:
+                typedef arraymap<_Key, _Tp, Ordering, std::allocator<_Tp>, RadixBits, stats_none, Counted> map_type;
+                typedef typename map_type::key_type key_type;
+                typedef typename map_type::radix_type radix_type;
+                typedef typename map_type::mapped_type mapped_type;
+                typedef typename map_type::value_type value_type;
+                typedef typename map_type::size_type size_type;
+                typedef std::pair<key_type, std::reference_wrapper<const mapped_type>> reference;
+
+            private:
+                typedef typename map_type::node_s node_s;
+                typedef typename map_type::ptr_s ptr_s;
+                typedef typename map_type::image_header_s header_s;
+                static constexpr unsigned short MAX_DEPTH = map_type::MAX_DEPTH;
+                static constexpr unsigned int FANOUT = map_type::FANOUT;
+
+            public:
+                class const_iterator{
+                    public:
+                        typedef std::forward_iterator_tag iterator_category;
+                        typedef typename mapped_arraymap::value_type value_type;
+                        typedef std::ptrdiff_t difference_type;
+                        typedef typename mapped_arraymap::reference reference;
+
+                        const_iterator():
+                            const_iterator(nullptr)
+                    {
+                    }
+
+                        reference operator*() const
+                        {
+                            radix_type key;
+                            std::memcpy(&key, key_bytes, sizeof(radix_type));
+                            return reference(Ordering::restore(key), *current);
+                        }
+                        const_iterator &operator++()
+                        {
+                            owner->seek_from(*this, depth - 1, map_type::tetradeValue(key_bytes, 0) + 1);
+                            return *this;
+                        }
+                        const_iterator operator++(int)
+                        {
+                            const_iterator tmp(*this);
+                            operator++();
+                            return tmp;
+                        }
+                        bool operator==(const const_iterator &other) const
+                        {
+                            if(depth == 0 || other.depth == 0)
+                                return depth == other.depth;
+                            return std::memcmp(key_bytes, other.key_bytes, sizeof(radix_type)) == 0;
+                        }
+                        bool operator!=(const const_iterator &other) const
+                        {
+                            return !(*this == other);
+                        }
+
+                    private:
+                        friend class mapped_arraymap;
+                        const mapped_arraymap *owner;
+                        const node_s *path[MAX_DEPTH];
+                        int depth;
+                        unsigned char key_bytes[sizeof(radix_type)];
+                        const mapped_type *current;
+
+                        const_iterator(const mapped_arraymap *owner):
+                            owner(owner),
+                            depth(0),
+                            current(nullptr)
+                    {
+                    }
+                };
+
+                /*
+                 * Maps the image at path, throwing std::runtime_error if it cannot be read or was saved by another
+                 * kind of map.
+                 */
+                explicit mapped_arraymap(const std::string &path)
+                {
+                    int fd = open(path.c_str(), O_RDONLY);
+                    if(fd < 0)
+                        throw std::runtime_error("mapped_arraymap: cannot open " + path);
+                    struct stat status;
+                    if(fstat(fd, &status) != 0 || (std::size_t)status.st_size < sizeof(header_s))
+                    {
+                        close(fd);
+                        throw std::runtime_error("mapped_arraymap: " + path + " is not an arraymap image");
+                    }
+                    void *mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                    close(fd);
+                    if(mapped == MAP_FAILED)
+                        throw std::runtime_error("mapped_arraymap: cannot map " + path);
+                    base = (const unsigned char*)mapped;
+                    length = status.st_size;
+
+                    const header_s *header = (const header_s*)base;
+                    header_s expected = map_type::image_header();
+                    if(std::memcmp(header, &expected, offsetof(header_s, element_count)) != 0 || header->size != length || header->root >= length)
+                    {
+                        munmap(mapped, length);
+                        throw std::runtime_error("mapped_arraymap: " + path + " is not an image of this map type");
+                    }
+                    element_count = header->element_count;
+                    root = node_at(header->root);
+                }
+                mapped_arraymap(mapped_arraymap &&other) noexcept:
+                    base(std::exchange(other.base, nullptr)),
+                    length(std::exchange(other.length, 0)),
+                    root(std::exchange(other.root, nullptr)),
+                    element_count(std::exchange(other.element_count, 0))
+            {
+            }
+                mapped_arraymap(const mapped_arraymap &) = delete;
+                mapped_arraymap &operator=(const mapped_arraymap &) = delete;
+                ~mapped_arraymap()
+                {
+                    if(base != nullptr)
+                        munmap((void*)base, length);
+                }
+
+                bool contains(const key_type &key) const
+                {
+                    return lookup(key) != nullptr;
+                }
+                const mapped_type &at(const key_type &key) const
+                {
+                    const mapped_type *value = lookup(key);
+                    if(value == nullptr)
+                        throw std::out_of_range("mapped_arraymap::at");
+                    return *value;
+                }
+                size_type size() const
+                {
+                    return element_count;
+                }
+                bool empty() const
+                {
+                    return element_count == 0;
+                }
+                const_iterator begin() const
+                {
+                    const_iterator it(this);
+                    if(root != nullptr)
+                        descend_first(it, root);
+                    return it;
+                }
+                const_iterator end() const
+                {
+                    return const_iterator(this);
+                }
+                const_iterator find(const key_type &key) const
+                {
+                    radix_type applied = Ordering::apply(key);
+                    const_iterator it = lower_bound(key);
+                    if(it.depth != 0 && std::memcmp(it.key_bytes, &applied, sizeof(radix_type)) != 0)
+                        return end();
+                    return it;
+                }
+                const_iterator lower_bound(const key_type &key) const
+                {
+                    const_iterator it(this);
+                    radix_type applied = Ordering::apply(key);
+                    std::memcpy(it.key_bytes, &applied, sizeof(radix_type));
+
+                    for(const node_s *node = root; node != nullptr;)
+                    {
+                        it.path[it.depth++] = node;
+                        int split = map_type::prefix_mismatch(it.key_bytes, node);
+                        if(split >= 0)
+                        {
+                            it.depth--;
+                            if(map_type::tetradeValue(node->prefix, split) > map_type::tetradeValue(it.key_bytes, split))
+                                descend_first(it, node);
+                            else if(it.depth == 0)
+                                return end();
+                            else
+                                seek_from(it, it.depth - 1, map_type::tetradeValue(it.key_bytes, it.path[it.depth - 1]->level) + 1);
+                            return it;
+                        }
+
+                        int tetrade = map_type::tetradeValue(it.key_bytes, node->level);
+                        if(node->level != 0)
+                        {
+                            std::uint64_t next = child(node, tetrade);
+                            if(next != 0)
+                            {
+                                node = node_at(next);
+                                continue;
+                            }
+                            tetrade++;
+                        }
+                        seek_from(it, it.depth - 1, tetrade);
+                        return it;
+                    }
+                    return it;
+                }
+                const_iterator upper_bound(const key_type &key) const
+                {
+                    const_iterator it = find(key);
+                    if(it.depth != 0)
+                        return ++it;
+                    return lower_bound(key);
+                }
+
+            private:
+                const unsigned char *base;
+                std::size_t length;
+                const node_s *root;
+                size_type element_count;
+
+                const node_s *node_at(std::uint64_t offset) const
+                {
+                    return offset == 0 ? nullptr : (const node_s*)(base + offset);
+                }
+                /*
+                 * Offset of node's child at tetrade, 0 if there is none. Full nodes were saved with 0 in their empty
+                 * slots, sorted nodes hand out the empty node for a missing tetrade.
+                 */
+                static std::uint64_t child(const node_s *node, int tetrade)
+                {
+                    const ptr_s *slot = map_type::node_child(node, tetrade);
+                    return map_type::is_empty(*slot) ? 0 : (std::uint64_t)(std::uintptr_t)slot->next;
+                }
+                const mapped_type *value(const node_s *leaf, int tetrade) const
+                {
+                    if constexpr(map_type::INLINE_VALUES)
+                        return map_type::leaf_value(leaf, tetrade);
+                    else
+                    {
+                        std::uint64_t offset = child(leaf, tetrade);
+                        return offset == 0 ? nullptr : (const mapped_type*)(base + offset);
+                    }
+                }
+                const mapped_type *lookup(const key_type &key) const
+                {
+                    radix_type applied = Ordering::apply(key);
+                    const unsigned char *key_bytes = (const unsigned char*)&applied;
+                    const node_s *node = root;
+                    while(node != nullptr && node->level != 0)
+                        node = node_at(child(node, map_type::tetradeValue(key_bytes, node->level)));
+                    if(node == nullptr || !map_type::prefix_matches(key_bytes, node))
+                        return nullptr;
+                    return value(node, map_type::tetradeValue(key_bytes, 0));
+                }
+                /*
+                 * Positions it on the element at tetrade of node, which sits at it.path[it.depth - 1], or on the first
+                 * element below its child there.
+                 */
+                void enter(const_iterator &it, const node_s *node, int tetrade) const
+                {
+                    if(node->level != 0)
+                    {
+                        descend_first(it, node_at(child(node, tetrade)));
+                        return;
+                    }
+                    std::memcpy(it.key_bytes, node->prefix, sizeof(radix_type));
+                    map_type::setTetrade(it.key_bytes, 0, tetrade);
+                    it.current = value(node, tetrade);
+                }
+                void descend_first(const_iterator &it, const node_s *node) const
+                {
+                    it.path[it.depth++] = node;
+                    enter(it, node, map_type::node_next_tetrade(node, 0));
+                }
+                /*
+                 * Moves it to the first element at or after tetrade from of it.path[level], going up the path for as
+                 * long as a node has nothing left there, and to end() if none has.
+                 */
+                void seek_from(const_iterator &it, int level, int from) const
+                {
+                    for(; level >= 0; level--)
+                    {
+                        const node_s *node = it.path[level];
+                        int tetrade = map_type::node_next_tetrade(node, from);
+                        if(tetrade < (int)FANOUT)
+                        {
+                            it.depth = level + 1;
+                            enter(it, node, tetrade);
+                            return;
+                        }
+                        if(level > 0)
+                            from = map_type::tetradeValue(it.key_bytes, it.path[level - 1]->level) + 1;
+                    }
+                    it.depth = 0;
+                }
+        };
+#endif
 }
 
 #endif
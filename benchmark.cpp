@@ -0,0 +1,447 @@
+/*
+ * Benchmarks arraymap against std::map, std::unordered_map and a flat hash map (a plain linear probing table, or
+ * absl::flat_hash_map when built with -DBENCHMARK_ABSL and linked against abseil).
+ *
+ * Every key type from int8_t to int64_t, float and double is run with the default ordering on four distributions:
+ * a dense range, clustered ranges of 256 consecutive keys, keys spread uniformly over the whole type and the uniform
+ * keys looked up with a Zipf (s = 1) skew. Throughput is reported per operation together with the median and 99th
+ * percentile latency (timed over batches of BATCH operations), peak RSS per container comes from running each of them
+ * in a process of its own.
+ *
+ * Build next to the header and run, optionally narrowed down to some key types, distributions or containers:
+ *
+ *      g++ -std=c++20 -O2 -DNDEBUG benchmark.cpp -o benchmark
+ *      ./benchmark [elements] [key type] [distribution] [container]
+ *
+ *      ./benchmark 1000000 int32_t uniform arraymap
+ *
+ *      g++ -std=c++20 -O2 -DNDEBUG -DBENCHMARK_ABSL benchmark.cpp -o benchmark -labsl_hash -labsl_raw_hash_set
+ */
+
+#include "arraymap.h"
+
+#include <map>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define BENCHMARK_FORK
+#endif
+
+#ifdef BENCHMARK_ABSL
+#include <absl/container/flat_hash_map.h>
+#endif
+
+namespace benchmark{
+
+    static constexpr std::size_t BATCH = 64;
+
+    /*
+     * Open addressing with linear probing and backward shift deletion, kept at most half full.
+     */
+    template<class K, class V>
+        class flat_hash_map{
+            public:
+                flat_hash_map():
+                    slots(16),
+                    used(16, 0),
+                    count(0)
+            {
+            }
+                bool insert(const std::pair<K, V> &value)
+                {
+                    std::size_t i = probe(value.first);
+                    if(used[i])
+                        return false;
+                    if((count + 1) * 2 > slots.size())
+                    {
+                        rehash(slots.size() * 2);
+                        i = probe(value.first);
+                    }
+                    used[i] = 1;
+                    slots[i] = value;
+                    count++;
+                    return true;
+                }
+                V &operator[](const K &key)
+                {
+                    std::size_t i = probe(key);
+                    if(!used[i])
+                    {
+                        if((count + 1) * 2 > slots.size())
+                        {
+                            rehash(slots.size() * 2);
+                            i = probe(key);
+                        }
+                        used[i] = 1;
+                        slots[i] = std::pair<K, V>(key, V());
+                        count++;
+                    }
+                    return slots[i].second;
+                }
+                V *find(const K &key)
+                {
+                    std::size_t i = probe(key);
+                    return used[i] ? &slots[i].second : nullptr;
+                }
+                bool contains(const K &key) const
+                {
+                    return used[probe(key)];
+                }
+                std::size_t erase(const K &key)
+                {
+                    std::size_t i = probe(key);
+                    if(!used[i])
+                        return 0;
+                    std::size_t mask = slots.size() - 1;
+                    for(std::size_t j = (i + 1) & mask; used[j]; j = (j + 1) & mask)
+                    {
+                        std::size_t home = hash(slots[j].first) & mask;
+                        if(( (j - home) & mask ) >= ( (j - i) & mask ))
+                        {
+                            slots[i] = slots[j];
+                            i = j;
+                        }
+                    }
+                    used[i] = 0;
+                    count--;
+                    return 1;
+                }
+                std::size_t size() const
+                {
+                    return count;
+                }
+                template<class F>
+                    void for_each(F &&f) const
+                    {
+                        for(std::size_t i = 0; i < slots.size(); i++)
+                            if(used[i])
+                                f(slots[i].first, slots[i].second);
+                    }
+
+            private:
+                std::vector<std::pair<K, V>> slots;
+                std::vector<unsigned char> used;
+                std::size_t count;
+
+                static std::size_t hash(const K &key)
+                {
+                    std::uint64_t bits = 0;
+                    std::memcpy(&bits, &key, sizeof(K));
+                    bits += 0x9e3779b97f4a7c15;
+                    bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9;
+                    bits = (bits ^ (bits >> 27)) * 0x94d049bb133111eb;
+                    return bits ^ (bits >> 31);
+                }
+                std::size_t probe(const K &key) const
+                {
+                    std::size_t mask = slots.size() - 1;
+                    std::size_t i = hash(key) & mask;
+                    for(; used[i] && !(slots[i].first == key); i = (i + 1) & mask);
+                    return i;
+                }
+                void rehash(std::size_t capacity)
+                {
+                    flat_hash_map bigger;
+                    bigger.slots.resize(capacity);
+                    bigger.used.assign(capacity, 0);
+                    for_each([&](const K &key, const V &value){ bigger.insert(std::pair<K, V>(key, value)); });
+                    *this = std::move(bigger);
+                }
+        };
+
+    template<class K>
+        struct key_name;
+    template<> struct key_name<std::int8_t>{ static constexpr const char *value = "int8_t"; };
+    template<> struct key_name<std::int16_t>{ static constexpr const char *value = "int16_t"; };
+    template<> struct key_name<std::int32_t>{ static constexpr const char *value = "int32_t"; };
+    template<> struct key_name<std::int64_t>{ static constexpr const char *value = "int64_t"; };
+    template<> struct key_name<float>{ static constexpr const char *value = "float"; };
+    template<> struct key_name<double>{ static constexpr const char *value = "double"; };
+
+    enum distribution { DENSE, CLUSTERED, UNIFORM, ZIPF };
+    static const char *distribution_names[] = { "dense", "clustered", "uniform", "zipf" };
+    enum container { ARRAYMAP, STD_MAP, STD_UNORDERED_MAP, FLAT_HASH_MAP };
+    static const char *container_names[] = { "arraymap", "std::map", "std::unordered_map", "flat_hash_map" };
+
+    template<class K>
+        K key_from(long double value)
+        {
+            if constexpr(std::is_floating_point<K>::value)
+                return (K)value;
+            else
+                return (K)std::clamp<long double>(value, std::numeric_limits<K>::min(), std::numeric_limits<K>::max());
+        }
+
+    template<class K>
+        K random_key(std::mt19937_64 &rng)
+        {
+            if constexpr(std::is_floating_point<K>::value)
+                return (K)std::uniform_real_distribution<double>(-1e12, 1e12)(rng);
+            else
+                return (K)rng();
+        }
+
+    /*
+     * count distinct keys of the distribution (fewer if the key type has no room for them), in random order.
+     */
+    template<class K>
+        std::vector<K> make_keys(distribution dist, std::size_t count, std::mt19937_64 &rng)
+        {
+            if constexpr(!std::is_floating_point<K>::value)
+                count = std::min<std::size_t>(count, (std::size_t)std::numeric_limits<K>::max() - std::numeric_limits<K>::min() + 1);
+
+            std::vector<K> keys;
+            keys.reserve(count);
+            if(dist == DENSE)
+            {
+                long double first = std::is_floating_point<K>::value || sizeof(K) > 2 ? -(long double)(count / 2) : (long double)std::numeric_limits<K>::min();
+                for(std::size_t i = 0; i < count; i++)
+                    keys.push_back(key_from<K>(first + i));
+            }
+            else
+            {
+                std::unordered_map<std::uint64_t, bool> seen;
+                auto bits = [](K key){ std::uint64_t value = 0; std::memcpy(&value, &key, sizeof(K)); return value; };
+                while(keys.size() < count)
+                {
+                    K base = random_key<K>(rng);
+                    if constexpr(!std::is_floating_point<K>::value)
+                        if(sizeof(K) <= 2)
+                            base = (K)(rng() % (count + 1) + std::numeric_limits<K>::min());
+                    unsigned int run = dist == CLUSTERED ? 256 : 1;
+                    for(unsigned int i = 0; i < run && keys.size() < count; i++)
+                    {
+                        K key = key_from<K>((long double)base + i);
+                        if(seen.emplace(bits(key), true).second)
+                            keys.push_back(key);
+                    }
+                    if constexpr(!std::is_floating_point<K>::value)
+                        if(sizeof(K) <= 2 && seen.size() * 2 > count)
+                        {
+                            for(long v = std::numeric_limits<K>::min(); keys.size() < count; v++)
+                                if(seen.emplace(bits((K)v), true).second)
+                                    keys.push_back((K)v);
+                        }
+                }
+            }
+            std::shuffle(keys.begin(), keys.end(), rng);
+            return keys;
+        }
+
+    /*
+     * Keys to look up: the inserted ones in random order, or with a Zipf skew over them.
+     */
+    template<class K>
+        std::vector<K> make_lookups(distribution dist, const std::vector<K> &keys, std::size_t count, std::mt19937_64 &rng)
+        {
+            std::vector<K> lookups(count);
+            if(dist != ZIPF)
+            {
+                for(K &key : lookups)
+                    key = keys[rng() % keys.size()];
+                return lookups;
+            }
+            std::vector<double> cdf(keys.size());
+            double sum = 0;
+            for(std::size_t i = 0; i < keys.size(); i++)
+                cdf[i] = sum += 1.0 / (i + 1);
+            std::uniform_real_distribution<double> uniform(0, sum);
+            for(K &key : lookups)
+                key = keys[std::min<std::size_t>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin(), keys.size() - 1)];
+            return lookups;
+        }
+
+    static volatile long sink;
+
+    struct result_s{
+        double mops;
+        double p50;
+        double p99;
+    };
+
+    /*
+     * Runs op(i) for every i below count, timing batches of BATCH.
+     */
+    template<class Op>
+        result_s measure(std::size_t count, Op &&op)
+        {
+            std::vector<double> latencies;
+            latencies.reserve(count / BATCH + 1);
+            auto start = std::chrono::steady_clock::now();
+            for(std::size_t begin = 0; begin < count; begin += BATCH)
+            {
+                std::size_t end = std::min(begin + BATCH, count);
+                auto batch_start = std::chrono::steady_clock::now();
+                for(std::size_t i = begin; i < end; i++)
+                    op(i);
+                auto batch_end = std::chrono::steady_clock::now();
+                latencies.push_back(std::chrono::duration<double, std::nano>(batch_end - batch_start).count() / (end - begin));
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::sort(latencies.begin(), latencies.end());
+            if(latencies.empty())
+                return {0, 0, 0};
+            return { count / seconds / 1e6, latencies[latencies.size() / 2], latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)] };
+        }
+
+    static long unwrap(long value)
+    {
+        return value;
+    }
+    static long unwrap(std::reference_wrapper<long> value)
+    {
+        return value.get();
+    }
+
+    template<class K, class M>
+        void run(const char *key, distribution dist, container kind, std::size_t count)
+        {
+            constexpr bool IS_ARRAYMAP = std::is_same<M, arraymap::arraymap<K, long>>::value;
+            constexpr bool IS_FLAT = std::is_same<M, flat_hash_map<K, long>>::value;
+            constexpr bool ORDERED = IS_ARRAYMAP || std::is_same<M, std::map<K, long>>::value;
+
+            std::mt19937_64 rng(1234);
+            std::vector<K> keys = make_keys<K>(dist, count, rng);
+            std::vector<K> lookups = make_lookups<K>(dist, keys, keys.size(), rng);
+            std::vector<K> probes(keys.size());
+            for(K &probe : probes)
+                probe = random_key<K>(rng);
+
+            auto report = [&](const char *op, result_s result)
+            {
+                std::printf("%-8s %-10s %-19s %-12s %10.2f %10.1f %10.1f\n", key, distribution_names[dist], container_names[kind], op, result.mops, result.p50, result.p99);
+            };
+
+            M map;
+            report("insert", measure(keys.size(), [&](std::size_t i){ map.insert(std::pair<K, long>(keys[i], (long)i)); }));
+            report("operator[]", measure(lookups.size(), [&](std::size_t i){ map[lookups[i]] += 1; }));
+            report("find", measure(lookups.size(), [&](std::size_t i)
+                        {
+                            if constexpr(IS_FLAT)
+                                sink = *map.find(lookups[i]);
+                            else if constexpr(IS_ARRAYMAP)
+                                sink = (*map.find(lookups[i])).second;
+                            else
+                                sink = map.find(lookups[i])->second;
+                        }));
+            report("contains", measure(lookups.size(), [&](std::size_t i){ sink = map.contains(i & 1 ? lookups[i] : probes[i]); }));
+            if constexpr(ORDERED)
+                report("lower_bound", measure(probes.size(), [&](std::size_t i){ sink = map.lower_bound(probes[i]) != map.end(); }));
+
+            auto iterate = [&](std::size_t)
+            {
+                long sum = 0;
+                if constexpr(IS_FLAT)
+                    map.for_each([&](const K &, long value){ sum += value; });
+                else
+                    for(auto &&element : map)
+                        sum += unwrap(element.second);
+                sink = sum;
+            };
+            result_s pass = measure(5, iterate);
+            report("iterate", { pass.mops * map.size(), pass.p50 / map.size(), pass.p99 / map.size() });
+            result_s copy = measure(3, [&](std::size_t){ M copy(map); sink = copy.size(); });
+            report("copy", { copy.mops * map.size(), copy.p50 / map.size(), copy.p99 / map.size() });
+
+            report("erase", measure(keys.size(), [&](std::size_t i){ sink = map.erase(keys[i]); }));
+        }
+
+    template<class K>
+        void run(const char *key, distribution dist, container kind, std::size_t count)
+        {
+            switch(kind)
+            {
+                case ARRAYMAP: run<K, arraymap::arraymap<K, long>>(key, dist, kind, count); break;
+                case STD_MAP: run<K, std::map<K, long>>(key, dist, kind, count); break;
+                case STD_UNORDERED_MAP: run<K, std::unordered_map<K, long>>(key, dist, kind, count); break;
+#ifdef BENCHMARK_ABSL
+                case FLAT_HASH_MAP: run<K, absl::flat_hash_map<K, long>>(key, dist, kind, count); break;
+#else
+                case FLAT_HASH_MAP: run<K, flat_hash_map<K, long>>(key, dist, kind, count); break;
+#endif
+            }
+        }
+
+    /*
+     * Runs one container on one distribution, in a child process where there is fork() so that its peak RSS
+     * is its own.
+     */
+    template<class K>
+        void run_isolated(distribution dist, container kind, std::size_t count)
+        {
+            const char *key = key_name<K>::value;
+#ifdef BENCHMARK_FORK
+            std::fflush(stdout);
+            pid_t child = fork();
+            if(child == 0)
+            {
+                run<K>(key, dist, kind, count);
+                std::fflush(stdout);
+                _exit(0);
+            }
+            int status;
+            struct rusage usage;
+            if(child < 0 || wait4(child, &status, 0, &usage) < 0)
+            {
+                std::perror("benchmark");
+                std::exit(1);
+            }
+#if defined(__APPLE__)
+            double rss = usage.ru_maxrss / 1048576.0;
+#else
+            double rss = usage.ru_maxrss / 1024.0;
+#endif
+            std::printf("%-8s %-10s %-19s %-12s %10.1f MiB\n", key, distribution_names[dist], container_names[kind], "peak RSS", rss);
+#else
+            run<K>(key, dist, kind, count);
+#endif
+        }
+
+    template<class K>
+        void run_all(std::size_t count, const std::string &dist_filter, const std::string &container_filter)
+        {
+            for(int dist = DENSE; dist <= ZIPF; dist++)
+            {
+                if(!dist_filter.empty() && dist_filter != distribution_names[dist]) continue;
+                for(int kind = ARRAYMAP; kind <= FLAT_HASH_MAP; kind++)
+                {
+                    if(!container_filter.empty() && container_filter != container_names[kind]) continue;
+                    run_isolated<K>((distribution)dist, (container)kind, count);
+                }
+            }
+        }
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::string key_filter = argc > 2 ? argv[2] : "";
+    std::string dist_filter = argc > 3 ? argv[3] : "";
+    std::string container_filter = argc > 4 ? argv[4] : "";
+
+    std::printf("%-8s %-10s %-19s %-12s %10s %10s %10s\n", "key", "keys", "container", "operation", "Mops/s", "p50 ns", "p99 ns");
+    auto run_key = [&](auto key)
+    {
+        typedef decltype(key) K;
+        if(key_filter.empty() || key_filter == benchmark::key_name<K>::value)
+            benchmark::run_all<K>(count, dist_filter, container_filter);
+    };
+    run_key(std::int8_t());
+    run_key(std::int16_t());
+    run_key(std::int32_t());
+    run_key(std::int64_t());
+    run_key(float());
+    run_key(double());
+    return 0;
+}